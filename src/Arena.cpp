@@ -0,0 +1,117 @@
+/*
+ * Arena.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "Arena.h"
+
+namespace Matching
+{
+
+Arena::Arena( size_t bytes, bool hugePages ) :
+        m_base( NULL ), m_size( 0 ), m_used( 0 ), m_hugeTlb( false ), m_transparentHuge( false )
+{
+    memset( m_freeLists, 0, sizeof( m_freeLists ) );
+
+    size_t pageSize = hugePages ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+    m_size = ( bytes + pageSize - 1 ) / pageSize * pageSize;
+    if( m_size == 0 )
+        return;
+
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if( hugePages )
+    {
+        p = mmap( NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        m_hugeTlb = p != MAP_FAILED;
+    }
+#endif
+    if( p == MAP_FAILED )
+        p = mmap( NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( p == MAP_FAILED )
+    {
+        fprintf( stderr, "Cannot map %zu bytes for the arena, using the heap\n", m_size );
+        m_size = 0;
+        return;
+    }
+    m_base = (char*)p;
+
+#ifdef MADV_HUGEPAGE
+    if( hugePages && !m_hugeTlb )
+        m_transparentHuge = madvise( m_base, m_size, MADV_HUGEPAGE ) == 0;
+#endif
+    if( hugePages && !m_hugeTlb && !m_transparentHuge )
+        fprintf( stderr, "Huge pages unavailable, arena uses regular pages\n" );
+}
+
+Arena::~Arena()
+{
+    if( m_base != NULL )
+        munmap( m_base, m_size );
+}
+
+const char* Arena::getPageMode() const
+{
+    if( m_base == NULL )
+        return "heap";
+    if( m_hugeTlb )
+        return "hugetlb";
+    if( m_transparentHuge )
+        return "thp";
+    return "4k";
+}
+
+/**
+ * Touch every page so that no page fault happens mid session
+ *  return the number of bytes faulted in
+ * */
+size_t Arena::prefault()
+{
+    if( m_base == NULL )
+        return 0;
+    volatile char* p = m_base;
+    for( size_t off = 0; off < m_size; off += SMALL_PAGE_SIZE )
+        p[ off ] = 0;
+    return m_size;
+}
+
+/**
+ * Lock the arena in RAM, return 0 on success
+ * */
+int Arena::lock()
+{
+    if( m_base == NULL )
+        return -1;
+    if( mlock( m_base, m_size ) != 0 )
+    {
+        perror( "mlock arena" );
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Pin the calling thread to one core, return 0 on success
+ * */
+int pinCurrentThread( int core )
+{
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    CPU_SET( core, &cpus );
+    int err = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+    if( err != 0 )
+    {
+        fprintf( stderr, "Cannot pin thread to core %d: %s\n", core, strerror( err ) );
+        return -1;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,199 @@
+/*
+ * Arena.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace Matching
+{
+
+#define ARENA_ALIGN 16
+#define ARENA_NCLASS 16 // size classes of ARENA_ALIGN bytes, up to 256 bytes
+#define ARENA_LARGE_SHIFT 9 // then power of two classes from 512 bytes
+#define ARENA_NLARGE 20 // up to 256MB, e.g. hash map bucket arrays
+#define SMALL_PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE ( 2 * 1024 * 1024 )
+
+/**
+ * Fixed size memory region for the order book nodes and orders
+ *  Backed by 2MB huge pages when asked: explicit hugetlb pages first, then
+ *  transparent huge pages via madvise, then regular pages.
+ *  Blocks are carved by bumping a pointer and recycled through per size class
+ *  free lists: ARENA_ALIGN steps for small blocks (orders, tree nodes), powers
+ *  of two above that (hash bucket arrays, which grow by about 2x on rehash).
+ *  Blocks above the largest class and blocks that do not fit any more fall
+ *  back to the heap, so callers never see an allocation failure.
+ *  Not thread safe: an arena belongs to one OrderBook, which passes it
+ *  explicitly to everything it allocates, and is used from the book's thread only.
+ * */
+class Arena
+{
+private:
+    char* m_base;
+    size_t m_size;
+    size_t m_used;
+    bool m_hugeTlb; // backed by explicit hugetlb pages
+    bool m_transparentHuge; // madvise(MADV_HUGEPAGE) accepted
+    void* m_freeLists[ ARENA_NCLASS + ARENA_NLARGE ];
+
+    static int sizeClass( size_t n, size_t& bytes );
+
+public:
+    Arena( size_t bytes, bool hugePages );
+    virtual ~Arena();
+
+    bool isValid() const { return m_base != NULL; }
+    bool owns( const void* p ) const { return (const char*)p >= m_base && (const char*)p < m_base + m_used; }
+    size_t getSize() const { return m_size; }
+    size_t getUsed() const { return m_used; }
+    const char* getPageMode() const;
+
+    void* allocate( size_t n );
+    void deallocate( void* p, size_t n );
+
+    size_t prefault();
+    int lock();
+};
+
+/**
+ * Free list index of a block of n bytes and the bytes it takes in the arena,
+ * -1 if the block is too large for the arena
+ * */
+inline
+int Arena::sizeClass( size_t n, size_t& bytes )
+{
+    if( n == 0 )
+        return -1;
+    if( n <= ARENA_NCLASS * ARENA_ALIGN )
+    {
+        size_t cls = ( n + ARENA_ALIGN - 1 ) / ARENA_ALIGN;
+        bytes = cls * ARENA_ALIGN;
+        return (int)cls - 1;
+    }
+
+    int shift = 64 - __builtin_clzll( (unsigned long long)n - 1 ); // smallest 2^shift >= n
+    if( shift >= ARENA_LARGE_SHIFT + ARENA_NLARGE )
+        return -1;
+    bytes = (size_t)1 << shift;
+    return ARENA_NCLASS + shift - ARENA_LARGE_SHIFT;
+}
+
+inline
+void* Arena::allocate( size_t n )
+{
+    size_t bytes;
+    int cls = sizeClass( n, bytes );
+    if( cls < 0 )
+        return NULL;
+
+    void*& freeList = m_freeLists[ cls ];
+    if( freeList != NULL )
+    {
+        void* p = freeList;
+        freeList = *(void**)p;
+        return p;
+    }
+
+    if( m_base == NULL || m_used + bytes > m_size )
+        return NULL;
+    void* p = m_base + m_used;
+    m_used += bytes;
+    return p;
+}
+
+inline
+void Arena::deallocate( void* p, size_t n )
+{
+    size_t bytes;
+    void*& freeList = m_freeLists[ sizeClass( n, bytes ) ];
+    *(void**)p = freeList;
+    freeList = p;
+}
+
+/**
+ * Allocate from arena, or from the heap if arena is NULL or full
+ * */
+inline
+void* arenaAllocate( Arena* arena, size_t n )
+{
+    if( arena != NULL )
+    {
+        void* p = arena->allocate( n );
+        if( p != NULL )
+            return p;
+    }
+    return ::operator new( n );
+}
+
+/**
+ * Release a block of arenaAllocate( arena, n ), or any heap block
+ * */
+inline
+void arenaDeallocate( Arena* arena, void* p, size_t n )
+{
+    if( arena != NULL && arena->owns( p ) )
+        arena->deallocate( p, n );
+    else
+        ::operator delete( p );
+}
+
+/**
+ * Construct a T in arena, heap if NULL or full
+ * */
+template< class T, class... Args >
+inline
+T* arenaNew( Arena* arena, Args&&... args )
+{
+    return new( arenaAllocate( arena, sizeof( T ) ) ) T( std::forward< Args >( args )... );
+}
+
+/**
+ * Destroy a T of arenaNew( arena, ... ), or of plain new
+ * */
+template< class T >
+inline
+void arenaDelete( Arena* arena, const T* p )
+{
+    if( p == NULL )
+        return;
+    p->~T();
+    arenaDeallocate( arena, const_cast< T* >( p ), sizeof( T ) );
+}
+
+/**
+ * STL allocator drawing container nodes from a given arena, heap if NULL
+ * */
+template< class T >
+struct ArenaAllocator
+{
+    typedef T value_type;
+    Arena* m_arena;
+
+    ArenaAllocator( Arena* arena = NULL ) : m_arena( arena ) {}
+    template< class U > ArenaAllocator( const ArenaAllocator< U >& other ) : m_arena( other.m_arena ) {}
+
+    T* allocate( size_t n ) { return (T*)arenaAllocate( m_arena, n * sizeof( T ) ); }
+    void deallocate( T* p, size_t n ) { arenaDeallocate( m_arena, p, n * sizeof( T ) ); }
+};
+
+template< class T, class U >
+inline
+bool operator == ( const ArenaAllocator< T >& lhs, const ArenaAllocator< U >& rhs ) { return lhs.m_arena == rhs.m_arena; }
+
+template< class T, class U >
+inline
+bool operator != ( const ArenaAllocator< T >& lhs, const ArenaAllocator< U >& rhs ) { return lhs.m_arena != rhs.m_arena; }
+
+int pinCurrentThread( int core );
+
+}
+
+#endif /* ARENA_H_ */
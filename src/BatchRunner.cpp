@@ -0,0 +1,216 @@
+/*
+ * BatchRunner.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "BatchRunner.h"
+
+namespace Matching
+{
+
+BatchRunner::BatchRunner( int nThreads ) : m_nThreads( nThreads ), m_wallMs( 0 )
+{
+    if( m_nThreads <= 0 )
+        m_nThreads = thread::hardware_concurrency();
+    if( m_nThreads <= 0 )
+        m_nThreads = 1;
+}
+
+void BatchRunner::clean()
+{
+    for( WorkQueue* queue : m_queues )
+        delete queue;
+    m_queues.clear();
+}
+
+/**
+ * Add every regular, non hidden file in dir, in name order
+ * */
+int BatchRunner::addDirectory( const string& dir )
+{
+    DIR* dp = opendir( dir.c_str() );
+    if( NULL == dp )
+    {
+        fprintf( stderr, "Cannot open directory at %s\n", dir.c_str() );
+        return -1;
+    }
+
+    vector< string > files;
+    struct dirent* entry;
+    while( ( entry = readdir( dp ) ) != NULL )
+    {
+        if( entry->d_name[ 0 ] == '.' )
+            continue;
+        string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if( stat( path.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) )
+            files.push_back( path );
+    }
+    closedir( dp );
+
+    sort( files.begin(), files.end() );
+    m_files.insert( m_files.end(), files.begin(), files.end() );
+    return 0;
+}
+
+/**
+ * Add one file per non empty line of manifest
+ * */
+int BatchRunner::addManifest( const string& manifest )
+{
+    ifstream in( manifest.c_str() );
+    if( !in )
+    {
+        fprintf( stderr, "Cannot open manifest at %s\n", manifest.c_str() );
+        return -1;
+    }
+
+    string line;
+    while( getline( in, line ) )
+    {
+        if( !line.empty() && line[ line.size() - 1 ] == '\r' )
+            line.erase( line.size() - 1 );
+        if( !line.empty() )
+            m_files.push_back( line );
+    }
+    return 0;
+}
+
+/**
+ * Pop own queue first, otherwise steal the longest session left in the other queues
+ * */
+bool BatchRunner::nextSession( int worker, int& session )
+{
+    {
+        WorkQueue* own = m_queues[ worker ];
+        lock_guard< mutex > lock( own->m_mutex );
+        if( !own->m_sessions.empty() )
+        {
+            session = own->m_sessions.front();
+            own->m_sessions.pop_front();
+            return true;
+        }
+    }
+
+    for( ;; )
+    {
+        // queues are sorted, so the longest session of a victim is at its front
+        WorkQueue* victim = NULL;
+        long long victimSize = -1;
+        for( int i = 1; i < m_nThreads; ++i )
+        {
+            WorkQueue* queue = m_queues[ ( worker + i ) % m_nThreads ];
+            lock_guard< mutex > lock( queue->m_mutex );
+            if( !queue->m_sessions.empty() && m_sizes[ queue->m_sessions.front() ] > victimSize )
+            {
+                victim = queue;
+                victimSize = m_sizes[ queue->m_sessions.front() ];
+            }
+        }
+        if( victim == NULL )
+            return false;
+
+        // the victim may have drained its queue since, then look again
+        lock_guard< mutex > lock( victim->m_mutex );
+        if( !victim->m_sessions.empty() )
+        {
+            session = victim->m_sessions.front();
+            victim->m_sessions.pop_front();
+            return true;
+        }
+    }
+}
+
+void BatchRunner::work( int worker )
+{
+    int session;
+    while( nextSession( worker, session ) )
+    {
+        MatchingEngine engine;
+        engine.replay( m_files[ session ], m_stats[ session ] );
+    }
+}
+
+/**
+ * Replay all sessions, return -1 if any file could not be opened
+ * */
+int BatchRunner::run()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    clean();
+    m_stats.assign( m_files.size(), SessionStats() );
+    for( size_t i = 0; i < m_files.size(); ++i )
+        m_stats[ i ].m_file = m_files[ i ];
+
+    // longest file first
+    vector< pair< long long, int > > bySize;
+    m_sizes.assign( m_files.size(), 0 );
+    for( size_t i = 0; i < m_files.size(); ++i )
+    {
+        struct stat st;
+        m_sizes[ i ] = stat( m_files[ i ].c_str(), &st ) == 0 ? st.st_size : 0;
+        bySize.push_back( make_pair( -m_sizes[ i ], (int)i ) );
+    }
+    sort( bySize.begin(), bySize.end() );
+
+    for( int i = 0; i < m_nThreads; ++i )
+        m_queues.push_back( new WorkQueue() );
+    for( size_t i = 0; i < bySize.size(); ++i )
+        m_queues[ i % m_nThreads ]->m_sessions.push_back( bySize[ i ].second );
+
+    vector< thread > workers;
+    for( int i = 1; i < m_nThreads; ++i )
+        workers.push_back( thread( &BatchRunner::work, this, i ) );
+    work( 0 );
+    for( thread& worker : workers )
+        worker.join();
+    m_wallMs = chrono::duration< double, milli >( chrono::steady_clock::now() - start ).count();
+
+    int status = 0;
+    for( const SessionStats& stats : m_stats )
+        if( stats.m_status != 0 )
+            status = -1;
+    return status;
+}
+
+/**
+ * One line per session in input order followed by the totals, with the wall time
+ * and throughput of the whole batch, next to the sum of the session times
+ * */
+void BatchRunner::summary( ostream& out ) const
+{
+    long orders = 0, badLines = 0, exposure = 0;
+    int failed = 0;
+    double elapsedMs = 0;
+
+    out << "file,status,exposure,orders,badLines,elapsedMs" << endl;
+    for( const SessionStats& stats : m_stats )
+    {
+        out << stats.m_file << "," << ( stats.m_status == 0 ? "OK" : "FAIL" ) << "," <<
+                ( stats.m_exposure >= 0 ? "L" : "S" ) << abs( stats.m_exposure ) << "," <<
+                stats.m_orders << "," << stats.m_badLines << "," << stats.m_elapsedMs << endl;
+        if( stats.m_status != 0 )
+            ++failed;
+        orders += stats.m_orders;
+        badLines += stats.m_badLines;
+        exposure += stats.m_exposure;
+        elapsedMs += stats.m_elapsedMs;
+    }
+    out << "TOTAL sessions " << m_stats.size() << " failed " << failed << " threads " << m_nThreads <<
+            " exposure " << ( exposure >= 0 ? "L" : "S" ) << labs( exposure ) <<
+            " orders " << orders << " badLines " << badLines <<
+            " sessionMs " << elapsedMs << " wallMs " << m_wallMs <<
+            " ordersPerSec " << (long)( m_wallMs > 0 ? orders * 1000.0 / m_wallMs : 0 ) << endl;
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+ * BatchRunner.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef BATCHRUNNER_H_
+#define BATCHRUNNER_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "MatchingEngine.h"
+using namespace std;
+
+namespace Matching
+{
+
+/**
+ * Per worker queue of session indices, longest file first
+ *  owner pops from the front, a thief also takes the front of the queue holding
+ *  the longest remaining session, so the tail of the batch stays short
+ * */
+typedef struct WorkQueue
+{
+    mutex m_mutex;
+    deque< int > m_sessions;
+} WorkQueue;
+
+/**
+ * Replay many independent order files, one MatchingEngine per file, on a
+ * work stealing thread pool.
+ *  Sessions are dealt longest file first round robin over the workers, an idle
+ *  worker steals from the others. Each engine is destroyed as soon as its
+ *  session finishes, so memory is bounded by the sessions in flight.
+ * */
+class BatchRunner
+{
+private:
+    int m_nThreads;
+    vector< string > m_files;
+    vector< SessionStats > m_stats; // indexed like m_files
+    vector< long long > m_sizes; // file sizes in bytes, indexed like m_files
+    vector< WorkQueue* > m_queues;
+    double m_wallMs; // wall time of the last run()
+
+    bool nextSession( int worker, int& session );
+    void work( int worker );
+
+public:
+    BatchRunner( int nThreads = 0 );
+    virtual ~BatchRunner() { clean(); }
+
+    void clean();
+
+    void addSession( const string& file ) { m_files.push_back( file ); }
+    int addDirectory( const string& dir );
+    int addManifest( const string& manifest );
+
+    int getNumThreads() const { return m_nThreads; }
+    const vector< SessionStats >& getStats() const { return m_stats; }
+    double getWallMs() const { return m_wallMs; }
+
+    int run();
+    void summary( ostream& out ) const;
+};
+
+}
+
+#endif /* BATCHRUNNER_H_ */
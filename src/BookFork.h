@@ -0,0 +1,359 @@
+/*
+ * BookFork.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef BOOKFORK_H_
+#define BOOKFORK_H_
+
+#include <functional>
+#include <vector>
+#include "OrderBook.h"
+using namespace std;
+
+namespace Matching
+{
+
+/**
+ * Execution of a hypothetical order against one quote
+ * */
+typedef struct Fill
+{
+    int m_quoteId;
+    int m_price; // in cents
+    int m_quantity;
+
+    Fill( int quoteId, int price, int quantity ) : m_quoteId( quoteId ), m_price( price ), m_quantity( quantity ) {}
+} Fill;
+
+/**
+ * Walk the price levels of one side of a fork in priority order, merging the
+ * levels shared with the parent and the levels owned by the fork.
+ * A price present in the overlay hides the parent level, a NULL overlay node
+ * is a level the fork has depleted.
+ * */
+template< class It, class Better >
+class MergedLevelIt
+{
+private:
+    It m_shared, m_sharedEnd;
+    It m_own, m_ownEnd;
+    const PriceTree* m_overlay;
+
+    void skip()
+    {
+        while( m_shared != m_sharedEnd && m_overlay->find( m_shared->first ) != m_overlay->end() )
+            ++m_shared;
+        while( m_own != m_ownEnd && m_own->second == NULL )
+            ++m_own;
+    }
+
+    bool isOwn() const
+    {
+        return m_shared == m_sharedEnd ||
+                ( m_own != m_ownEnd && Better()( m_own->first, m_shared->first ) );
+    }
+
+public:
+    MergedLevelIt( It shared, It sharedEnd, It own, It ownEnd, const PriceTree* overlay ) :
+            m_shared( shared ), m_sharedEnd( sharedEnd ), m_own( own ), m_ownEnd( ownEnd ), m_overlay( overlay )
+    {
+        skip();
+    }
+
+    bool isValid() const { return m_shared != m_sharedEnd || m_own != m_ownEnd; }
+    int getPrice() const { return isOwn() ? m_own->first : m_shared->first; }
+    const PriceNode* getNode() const { return isOwn() ? m_own->second : m_shared->second; }
+
+    void next()
+    {
+        if( isOwn() )
+            ++m_own;
+        else
+            ++m_shared;
+        skip();
+    }
+};
+
+typedef MergedLevelIt< PriceTree::const_iterator, less< int > > MergedAskIt;
+typedef MergedLevelIt< PriceTree::const_reverse_iterator, greater< int > > MergedBidIt;
+
+/**
+ * Copy on write view of an OrderBook for what-if simulation
+ *  Forking is O(1), the fork only points at its parent. A price level is copied
+ *  into the fork the first time a hypothetical match or add modifies it, every
+ *  other level stays shared with the parent, so the cost of a simulation is
+ *  proportional to the levels it touches, not to the book size.
+ *  The parent is never modified and must not change while the fork is alive.
+ *  Stop orders are not simulated: a stop order simulates to no fill, and the
+ *  parent's resting stops are not triggered by hypothetical trades, so a fork
+ *  shows the book before any stop the order would set off in the engine.
+ * */
+class BookFork
+{
+private:
+    const OrderBook* m_parent;
+
+    // levels modified in the fork, < price, PriceNode or NULL if depleted in the fork >
+    PriceTree* m_bidOverlay;
+    PriceTree* m_askOverlay;
+
+    // exposure change of each trader in the fork
+    AccountMap* m_exposure;
+    vector< Fill >* m_fills;
+
+    MergedAskIt askLevels() const;
+    MergedBidIt bidLevels() const;
+    PriceNode* touch( bool isBid, int price, const PriceNode* shared );
+    template< class LevelIt > void sweep( LevelIt levels, const Order& order, int& qtyToMatch );
+    void bookTrade( int qty, const string& buyer, const string& seller );
+
+public:
+    BookFork( const OrderBook* parent );
+    virtual ~BookFork();
+
+    int simulate( const Order& order );
+    bool canFill( const Order& order, int qty ) const;
+    void match( const Order& order, int& qtyToMatch );
+    void add( const Order& order );
+
+    int getBestBid() const;
+    int getBestAsk() const;
+    int getLevelQuantity( int price, bool isBid ) const;
+    int getTraderExposure( const string& name ) const;
+    const vector< Fill >& getFills() const { return *m_fills; }
+    size_t getCopiedLevels() const { return m_bidOverlay->size() + m_askOverlay->size(); }
+};
+
+inline
+BookFork::BookFork( const OrderBook* parent ) : m_parent( parent )
+{
+    m_bidOverlay = new PriceTree();
+    m_askOverlay = new PriceTree();
+    m_exposure = new AccountMap();
+    m_fills = new vector< Fill >();
+}
+
+inline
+BookFork::~BookFork()
+{
+    for( PriceTreeIt it = m_bidOverlay->begin(); it != m_bidOverlay->end(); ++it )
+        delete it->second;
+    for( PriceTreeIt it = m_askOverlay->begin(); it != m_askOverlay->end(); ++it )
+        delete it->second;
+
+    delete m_bidOverlay;
+    delete m_askOverlay;
+    delete m_exposure;
+    delete m_fills;
+}
+
+inline
+MergedAskIt BookFork::askLevels() const
+{
+    const PriceTree* shared = m_parent->getAskTree();
+    return MergedAskIt( shared->begin(), shared->end(), m_askOverlay->begin(), m_askOverlay->end(), m_askOverlay );
+}
+
+inline
+MergedBidIt BookFork::bidLevels() const
+{
+    const PriceTree* shared = m_parent->getBidTree();
+    return MergedBidIt( shared->rbegin(), shared->rend(), m_bidOverlay->rbegin(), m_bidOverlay->rend(), m_bidOverlay );
+}
+
+/**
+ * Return the fork's own copy of the level at price, copying the shared level
+ * on first write
+ *  time: O(logL) if already owned, O(logL + K) to copy a level of K quotes
+ * */
+inline
+PriceNode* BookFork::touch( bool isBid, int price, const PriceNode* shared )
+{
+    PriceTree* overlay = isBid ? m_bidOverlay : m_askOverlay;
+    PriceTreeIt it = overlay->find( price );
+    if( it != overlay->end() )
+    {
+        if( it->second == NULL )
+            it->second = new PriceNode( price );
+        return it->second;
+    }
+
+    PriceNode* node = shared != NULL ? shared->clone() : new PriceNode( price );
+    overlay->emplace( price, node );
+    return node;
+}
+
+/**
+ * What if the order is sent now: match it, post the residual of a limit order.
+ * Order types follow MatchingEngine::processOrder, return the executed quantity
+ * */
+inline
+int BookFork::simulate( const Order& order )
+{
+    Order taker( order );
+    if( taker.m_type == MARKET )
+        taker.m_price = taker.m_isBuy ? MKT_BUY_PRICE : MKT_SELL_PRICE;
+    if( taker.m_quantity <= 0 || taker.isStop() ||
+            ( taker.m_type == FOK && !canFill( taker, taker.m_quantity ) ) )
+        return 0;
+
+    int qtyToMatch = taker.m_quantity;
+    match( taker, qtyToMatch );
+
+    if( qtyToMatch > 0 && taker.m_type == LIMIT )
+    {
+        taker.m_quantity = qtyToMatch;
+        add( taker );
+    }
+    return order.m_quantity - qtyToMatch;
+}
+
+/**
+ * Fill or kill feasibility on the merged levels, without copying any
+ * */
+inline
+bool BookFork::canFill( const Order& order, int qty ) const
+{
+    if( order.m_isBuy )
+    {
+        for( MergedAskIt it = askLevels();
+                it.isValid() && qty > 0 && m_parent->isMarketable( &order, it.getPrice(), true ); it.next() )
+            qty -= it.getNode()->getQuantity();
+    }
+    else
+    {
+        for( MergedBidIt it = bidLevels();
+                it.isValid() && qty > 0 && m_parent->isMarketable( &order, it.getPrice(), false ); it.next() )
+            qty -= it.getNode()->getQuantity();
+    }
+    return qty <= 0;
+}
+
+/**
+ * Hypothetical match of the order against the opposite side, same priority as
+ * OrderBook::match. Only the levels traded through are copied
+ * */
+inline
+void BookFork::match( const Order& order, int& qtyToMatch )
+{
+    if( order.m_isBuy )
+        sweep( askLevels(), order, qtyToMatch );
+    else
+        sweep( bidLevels(), order, qtyToMatch );
+}
+
+/**
+ * Walk the merged levels once, best first, copying each level traded through
+ *  time: O(D * ( logL + K )), D levels traded through, K quotes in each.
+ *  Copying a level inserts its price at the walk's position, the walk only
+ *  moves on once the level is depleted, then the NULL entry is skipped.
+ * */
+template< class LevelIt >
+void BookFork::sweep( LevelIt levels, const Order& order, int& qtyToMatch )
+{
+    bool isBuy = order.m_isBuy;
+    PriceTree* overlay = isBuy ? m_askOverlay : m_bidOverlay;
+
+    for( ; levels.isValid() && qtyToMatch > 0 && m_parent->isMarketable( &order, levels.getPrice(), isBuy );
+            levels.next() )
+    {
+        int bestPrice = levels.getPrice();
+        PriceNode* bestPriceNode = touch( !isBuy, bestPrice, levels.getNode() );
+        OrderTree* quotes = bestPriceNode->getOrderTree();
+
+        // for each order (in size > time sequence) in this price level
+        int qtyBefore = qtyToMatch;
+        while( !quotes->empty() && qtyToMatch > 0 )
+        {
+            Order* quote = *quotes->begin();
+            quotes->erase( quotes->begin() );
+
+            int curQty = quote->m_quantity;
+            int execQty = min( curQty, qtyToMatch );
+            bookTrade( execQty, isBuy ? order.m_name : quote->m_name, isBuy ? quote->m_name : order.m_name );
+            m_fills->push_back( Fill( quote->m_id, bestPrice, execQty ) );
+            qtyToMatch -= execQty;
+
+            // add residual back to order tree
+            if( curQty > execQty )
+            {
+                quote->m_quantity = curQty - execQty;
+                quotes->emplace( quote );
+            }
+            else
+                delete quote;
+        }
+        bestPriceNode->reduceQuantity( qtyBefore - qtyToMatch );
+
+        // order depletes current price level, hide the parent level
+        if( !quotes->empty() )
+            break;
+        delete bestPriceNode;
+        ( *overlay )[ bestPrice ] = NULL;
+    }
+}
+
+/**
+ * Hypothetical post to the order's side, copies the level it joins
+ * */
+inline
+void BookFork::add( const Order& order )
+{
+    bool isBuy = order.m_isBuy;
+    const PriceToNodeMap* shared = isBuy ? m_parent->getBidMap() : m_parent->getAskMap();
+    PriceToNodeMap::const_iterator it = shared->find( order.m_price );
+
+    PriceNode* node = touch( isBuy, order.m_price, it != shared->end() ? it->second : NULL );
+    node->insertOrder( new Order( order ) );
+}
+
+inline
+void BookFork::bookTrade( int qty, const string& buyer, const string& seller )
+{
+    ( *m_exposure )[ buyer ] += qty;
+    ( *m_exposure )[ seller ] -= qty;
+}
+
+inline
+int BookFork::getBestBid() const
+{
+    MergedBidIt it = bidLevels();
+    return it.isValid() ? it.getPrice() : INAN;
+}
+
+inline
+int BookFork::getBestAsk() const
+{
+    MergedAskIt it = askLevels();
+    return it.isValid() ? it.getPrice() : INAN;
+}
+
+inline
+int BookFork::getLevelQuantity( int price, bool isBid ) const
+{
+    const PriceTree* overlay = isBid ? m_bidOverlay : m_askOverlay;
+    PriceTree::const_iterator own = overlay->find( price );
+    if( own != overlay->end() )
+        return own->second != NULL ? own->second->getQuantity() : 0;
+
+    const PriceToNodeMap* shared = isBid ? m_parent->getBidMap() : m_parent->getAskMap();
+    PriceToNodeMap::const_iterator it = shared->find( price );
+    return it != shared->end() ? it->second->getQuantity() : 0;
+}
+
+/**
+ * Parent exposure plus the change in the fork
+ * */
+inline
+int BookFork::getTraderExposure( const string& name ) const
+{
+    AccountMap::const_iterator it = m_exposure->find( name );
+    return m_parent->getTraderExposure( name ) + ( it != m_exposure->end() ? it->second : 0 );
+}
+
+}
+
+#endif /* BOOKFORK_H_ */
@@ -0,0 +1,384 @@
+/*
+ * ChunkReader.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ChunkReader.h"
+
+namespace Matching
+{
+
+#define RING_ENTRIES CHUNK_DEPTH
+#define SQ_THREAD_IDLE_MS 1000
+#define PROBE_OPS 256
+
+static int ioUringSetup( unsigned entries, struct io_uring_params* params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int ioUringEnter( int fd, unsigned toSubmit, unsigned minComplete, unsigned flags )
+{
+    return syscall( __NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0 );
+}
+
+/**
+ * Whether the ring supports opcode, IORING_OP_READ needs 5.6 while rings exist
+ * since 5.1, and kernels before 5.6 cannot be probed either
+ * */
+static bool ioUringSupports( int fd, unsigned opcode )
+{
+    size_t size = sizeof( struct io_uring_probe ) + PROBE_OPS * sizeof( struct io_uring_probe_op );
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc( 1, size );
+    if( probe == NULL )
+        return false;
+    bool supported = syscall( __NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, PROBE_OPS ) == 0 &&
+            opcode <= probe->last_op && ( probe->ops[ opcode ].flags & IO_URING_OP_SUPPORTED ) != 0;
+    free( probe );
+    return supported;
+}
+
+//----------------------------------
+// ChunkReader
+//----------------------------------
+
+ChunkReader::ChunkReader() : m_fd( -1 ), m_fileSize( 0 ), m_nextOut( 0 ), m_inFlight( 0 ),
+        m_ringFd( -1 ), m_sqPoll( false ), m_sqRing( MAP_FAILED ), m_cqRing( MAP_FAILED ),
+        m_sqRingSize( 0 ), m_cqRingSize( 0 ), m_sqes( (struct io_uring_sqe*)MAP_FAILED ), m_sqesSize( 0 )
+{
+    for( int i = 0; i < CHUNK_DEPTH; ++i )
+    {
+        m_chunks[ i ].m_data = NULL;
+        m_chunks[ i ].m_len = 0;
+        m_chunks[ i ].m_index = -1;
+        m_chunks[ i ].m_ready = false;
+    }
+}
+
+/**
+ * Open path for streaming, async selects io_uring when the kernel allows it,
+ * ioCore >= 0 pins the kernel submission thread
+ * */
+int ChunkReader::open( const string& path, bool async, int ioCore )
+{
+    close();
+
+    m_fd = ::open( path.c_str(), O_RDONLY );
+    struct stat st;
+    if( m_fd < 0 || fstat( m_fd, &st ) != 0 )
+    {
+        fprintf( stderr, "Cannot open file at %s\n", path.c_str() );
+        close();
+        return -1;
+    }
+    m_fileSize = st.st_size;
+
+    for( int i = 0; i < CHUNK_DEPTH; ++i )
+    {
+        void* p = NULL;
+        if( posix_memalign( &p, 4096, CHUNK_SIZE ) != 0 )
+        {
+            close();
+            return -1;
+        }
+        m_chunks[ i ].m_data = (char*)p;
+    }
+
+    if( async && setupRing( ioCore ) )
+    {
+        for( int i = 0; i < CHUNK_DEPTH; ++i )
+            submit( i );
+    }
+    else
+        posix_fadvise( m_fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+    return 0;
+}
+
+void ChunkReader::close()
+{
+    // wait for reads still in flight before freeing their buffers
+    if( m_ringFd >= 0 )
+    {
+        while( m_inFlight > 0 && reap( true ) );
+        closeRing();
+    }
+
+    for( int i = 0; i < CHUNK_DEPTH; ++i )
+    {
+        free( m_chunks[ i ].m_data );
+        m_chunks[ i ].m_data = NULL;
+        m_chunks[ i ].m_ready = false;
+    }
+    if( m_fd >= 0 )
+        ::close( m_fd );
+    m_fd = -1;
+    m_fileSize = 0;
+    m_nextOut = 0;
+    m_inFlight = 0;
+}
+
+bool ChunkReader::setupRing( int ioCore )
+{
+    struct io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+    if( ioCore >= 0 )
+    {
+        params.flags = IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = ioCore;
+        params.sq_thread_idle = SQ_THREAD_IDLE_MS;
+        m_ringFd = ioUringSetup( RING_ENTRIES, &params );
+        if( m_ringFd < 0 )
+        {
+            fprintf( stderr, "Cannot poll io_uring from core %d: %s\n", ioCore, strerror( errno ) );
+            memset( &params, 0, sizeof( params ) );
+        }
+    }
+    if( m_ringFd < 0 )
+        m_ringFd = ioUringSetup( RING_ENTRIES, &params );
+    if( m_ringFd < 0 )
+        return false;
+    if( !ioUringSupports( m_ringFd, IORING_OP_READ ) )
+    {
+        fprintf( stderr, "io_uring cannot read files on this kernel, using read()\n" );
+        closeRing();
+        return false;
+    }
+    m_sqPoll = ( params.flags & IORING_SETUP_SQPOLL ) != 0;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    bool singleMmap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+    if( singleMmap )
+        m_sqRingSize = m_cqRingSize = max( m_sqRingSize, m_cqRingSize );
+
+    m_sqRing = mmap( NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ringFd, IORING_OFF_SQ_RING );
+    m_cqRing = singleMmap ? m_sqRing : mmap( NULL, m_cqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING );
+    m_sqesSize = params.sq_entries * sizeof( struct io_uring_sqe );
+    m_sqes = (struct io_uring_sqe*)mmap( NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ringFd, IORING_OFF_SQES );
+    if( m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED )
+    {
+        closeRing();
+        return false;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqTail = (unsigned*)( sq + params.sq_off.tail );
+    m_sqMask = (unsigned*)( sq + params.sq_off.ring_mask );
+    m_sqFlags = (unsigned*)( sq + params.sq_off.flags );
+    m_sqArray = (unsigned*)( sq + params.sq_off.array );
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)( cq + params.cq_off.head );
+    m_cqTail = (unsigned*)( cq + params.cq_off.tail );
+    m_cqMask = (unsigned*)( cq + params.cq_off.ring_mask );
+    m_cqes = (struct io_uring_cqe*)( cq + params.cq_off.cqes );
+    return true;
+}
+
+void ChunkReader::closeRing()
+{
+    if( m_sqes != MAP_FAILED )
+        munmap( m_sqes, m_sqesSize );
+    if( m_cqRing != MAP_FAILED && m_cqRing != m_sqRing )
+        munmap( m_cqRing, m_cqRingSize );
+    if( m_sqRing != MAP_FAILED )
+        munmap( m_sqRing, m_sqRingSize );
+    m_sqes = (struct io_uring_sqe*)MAP_FAILED;
+    m_sqRing = m_cqRing = MAP_FAILED;
+    if( m_ringFd >= 0 )
+        ::close( m_ringFd );
+    m_ringFd = -1;
+}
+
+/**
+ * Queue the read of chunk index into its buffer, nothing past the end of file
+ * */
+void ChunkReader::submit( long index )
+{
+    off_t offset = (off_t)index * CHUNK_SIZE;
+    if( offset >= m_fileSize )
+        return;
+
+    Chunk& chunk = m_chunks[ index % CHUNK_DEPTH ];
+    chunk.m_index = index;
+    chunk.m_len = min( (off_t)CHUNK_SIZE, m_fileSize - offset );
+    chunk.m_ready = false;
+
+    unsigned tail = *m_sqTail;
+    unsigned idx = tail & *m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[ idx ];
+    memset( sqe, 0, sizeof( *sqe ) );
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_fd;
+    sqe->addr = (uint64_t)(uintptr_t)chunk.m_data;
+    sqe->len = chunk.m_len;
+    sqe->off = offset;
+    sqe->user_data = index;
+    m_sqArray[ idx ] = idx;
+    __atomic_store_n( m_sqTail, tail + 1, __ATOMIC_RELEASE );
+    ++m_inFlight;
+
+    if( !m_sqPoll )
+        ioUringEnter( m_ringFd, 1, 0, 0 );
+    else if( __atomic_load_n( m_sqFlags, __ATOMIC_ACQUIRE ) & IORING_SQ_NEED_WAKEUP )
+        ioUringEnter( m_ringFd, 0, 0, IORING_ENTER_SQ_WAKEUP );
+}
+
+/**
+ * Drain the completion queue, wait for at least one completion if asked.
+ * A failed or short read is completed synchronously, return false on I/O error
+ * */
+bool ChunkReader::reap( bool wait )
+{
+    for( ;; )
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n( m_cqTail, __ATOMIC_ACQUIRE );
+        bool ok = true;
+        for( ; head != tail; ++head )
+        {
+            struct io_uring_cqe* cqe = &m_cqes[ head & *m_cqMask ];
+            Chunk& chunk = m_chunks[ cqe->user_data % CHUNK_DEPTH ];
+            size_t done = cqe->res > 0 ? cqe->res : 0;
+            if( done < chunk.m_len )
+                ok &= fill( chunk, done );
+            chunk.m_ready = true;
+            --m_inFlight;
+        }
+        bool reaped = head != *m_cqHead;
+        __atomic_store_n( m_cqHead, head, __ATOMIC_RELEASE );
+
+        if( !ok )
+            return false;
+        if( reaped || !wait )
+            return true;
+        if( ioUringEnter( m_ringFd, 0, 1, IORING_ENTER_GETEVENTS ) < 0 && errno != EINTR )
+            return false;
+    }
+}
+
+/**
+ * Read the rest of the chunk from byte done with pread, the file shrinking ends the stream
+ * */
+bool ChunkReader::fill( Chunk& chunk, size_t done )
+{
+    off_t offset = (off_t)chunk.m_index * CHUNK_SIZE;
+    while( done < chunk.m_len )
+    {
+        ssize_t n = pread( m_fd, chunk.m_data + done, chunk.m_len - done, offset + done );
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+        {
+            perror( "read" );
+            return false;
+        }
+        if( n == 0 )
+        {
+            chunk.m_len = done;
+            m_fileSize = offset + done;
+            break;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/**
+ * Hand out the next chunk in file order, valid until the following call
+ * */
+bool ChunkReader::next( const char*& data, size_t& len )
+{
+    if( m_fd < 0 || (off_t)m_nextOut * CHUNK_SIZE >= m_fileSize )
+        return false;
+
+    Chunk& chunk = m_chunks[ m_nextOut % CHUNK_DEPTH ];
+    if( m_ringFd >= 0 )
+    {
+        // the caller is done with the previous chunk, recycle its buffer
+        if( m_nextOut > 0 )
+            submit( m_nextOut - 1 + CHUNK_DEPTH );
+        while( !chunk.m_ready )
+            if( !reap( true ) )
+                return false;
+    }
+    else
+    {
+        off_t offset = (off_t)m_nextOut * CHUNK_SIZE;
+        readahead( m_fd, offset + CHUNK_SIZE, (size_t)CHUNK_DEPTH * CHUNK_SIZE );
+        chunk.m_index = m_nextOut;
+        chunk.m_len = min( (off_t)CHUNK_SIZE, m_fileSize - offset );
+        if( !fill( chunk, 0 ) )
+            return false;
+    }
+
+    chunk.m_ready = false;
+    ++m_nextOut;
+    data = chunk.m_data;
+    len = chunk.m_len;
+    return len > 0;
+}
+
+//----------------------------------
+// LineReader
+//----------------------------------
+
+/**
+ * Copy the next line without its '\n' into line, NUL terminated.
+ * A line longer than cap - 1 is truncated and flagged, see isTruncated()
+ * */
+bool LineReader::next( char* line, size_t cap )
+{
+    size_t n = 0;
+    bool any = false;
+    m_truncated = false;
+    for( ;; )
+    {
+        if( m_pos == m_end )
+        {
+            size_t len;
+            if( !m_reader.next( m_pos, len ) )
+            {
+                m_pos = m_end = NULL;
+                line[ n ] = '\0';
+                return any;
+            }
+            m_end = m_pos + len;
+        }
+
+        any = true;
+        const char* nl = (const char*)memchr( m_pos, '\n', m_end - m_pos );
+        const char* stop = nl != NULL ? nl : m_end;
+        size_t copy = min( (size_t)( stop - m_pos ), cap - 1 - n );
+        memcpy( line + n, m_pos, copy );
+        n += copy;
+        if( copy < (size_t)( stop - m_pos ) )
+            m_truncated = true;
+
+        if( nl != NULL )
+        {
+            m_pos = nl + 1;
+            line[ n ] = '\0';
+            return true;
+        }
+        m_pos = m_end;
+    }
+}
+
+}
@@ -0,0 +1,111 @@
+/*
+ * ChunkReader.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef CHUNKREADER_H_
+#define CHUNKREADER_H_
+
+#include <string>
+#include <sys/types.h>
+using namespace std;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace Matching
+{
+
+#define CHUNK_SIZE ( 1 << 20 )
+#define CHUNK_DEPTH 4 // reads in flight
+
+/**
+ * One read buffer, holds chunk m_index of the file once m_ready
+ * */
+typedef struct Chunk
+{
+    char* m_data;
+    size_t m_len;
+    long m_index;
+    bool m_ready;
+} Chunk;
+
+/**
+ * Streaming file reader handing out the file in order, CHUNK_SIZE bytes at a time
+ *  With io_uring, CHUNK_DEPTH reads are kept in flight: handing out chunk k
+ *  recycles the buffer of chunk k - 1 for chunk k - 1 + CHUNK_DEPTH, so the
+ *  caller parses one buffer while the kernel fills the others. Given an I/O
+ *  core, the submission queue is polled by a kernel thread pinned to it.
+ *  Without io_uring (old kernel, no IORING_OP_READ before 5.6, seccomp, or
+ *  disabled) it falls back to plain read() into one buffer, with readahead()
+ *  hinting the next CHUNK_DEPTH chunks.
+ * */
+class ChunkReader
+{
+private:
+    int m_fd;
+    off_t m_fileSize;
+    Chunk m_chunks[ CHUNK_DEPTH ];
+    long m_nextOut; // next chunk index to hand out
+    int m_inFlight; // reads submitted and not reaped yet
+
+    // io_uring, m_ringFd is -1 when using the read() fallback
+    int m_ringFd;
+    bool m_sqPoll;
+    void* m_sqRing;
+    void* m_cqRing;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+    unsigned* m_sqTail;
+    unsigned* m_sqMask;
+    unsigned* m_sqFlags;
+    unsigned* m_sqArray;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqMask;
+    struct io_uring_cqe* m_cqes;
+
+    bool setupRing( int ioCore );
+    void closeRing();
+    void submit( long index );
+    bool reap( bool wait );
+    bool fill( Chunk& chunk, size_t done );
+
+public:
+    ChunkReader();
+    virtual ~ChunkReader() { close(); }
+
+    int open( const string& path, bool async = true, int ioCore = -1 );
+    void close();
+
+    bool isAsync() const { return m_ringFd >= 0; }
+    bool next( const char*& data, size_t& len );
+};
+
+/**
+ * Split a ChunkReader stream into lines, a line straddling two chunks is stitched
+ * */
+class LineReader
+{
+private:
+    ChunkReader m_reader;
+    const char* m_pos;
+    const char* m_end;
+    bool m_truncated; // the last line did not fit
+
+public:
+    LineReader() : m_pos( NULL ), m_end( NULL ), m_truncated( false ) {}
+
+    int open( const string& path, bool async = true, int ioCore = -1 ) { return m_reader.open( path, async, ioCore ); }
+    bool isAsync() const { return m_reader.isAsync(); }
+    bool next( char* line, size_t cap );
+    bool isTruncated() const { return m_truncated; }
+};
+
+}
+
+#endif /* CHUNKREADER_H_ */
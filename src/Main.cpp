@@ -6,35 +6,150 @@
  */
 
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
 #include <unistd.h>
 #include "MatchingEngine.h"
+#include "BatchRunner.h"
+#include "OrderArchive.h"
 using namespace std;
 
+#define ARENA_DEFAULT_MB 512
+
 void usage()
 {
     cout << "Matching Engine\n" << endl;
-    cout << "Usage: matching [-i inputFile]\n" << endl;
+    cout << "Usage: matching [-i inputFile] [-d inputDir] [-m manifest] [-j threads] [-z archive]" << endl;
+    cout << "                [-A arenaMB] [-H] [-P] [-L] [-c core] [-C core] [-U] [-t] [-p] [-r report]\n" << endl;
     cout << "Options: " << endl;
-    cout << "  -i, input file order.csv path. If not specify, default to ../data/orders.csv" << endl;
+    cout << "  -i, input file order.csv path, or order archive. If not specify, default to ../data/orders.csv" << endl;
+    cout << "  -z, write the csv input file as a columnar order archive at the given path and exit" << endl;
+    cout << "  -d, batch mode, replay every file in the directory with one engine per file" << endl;
+    cout << "  -m, batch mode, replay every file listed (one path per line) in the manifest" << endl;
+    cout << "  -j, number of batch worker threads. If not specify, default to number of cores" << endl;
+    cout << "      the options below apply to a single input and are rejected in batch mode" << endl;
+    cout << "  -A, size in MB of the arena holding book and order memory. Default to " << ARENA_DEFAULT_MB <<
+            " if -H, -P or -L is given, heap otherwise" << endl;
+    cout << "  -H, back the arena with 2MB huge pages, fall back to transparent huge pages, fail on 4KB pages" << endl;
+    cout << "  -P, pre-fault the arena at startup" << endl;
+    cout << "  -L, mlock the arena" << endl;
+    cout << "  -c, pin the matching thread to the core" << endl;
+    cout << "  -C, poll io_uring submissions from a kernel thread pinned to the core" << endl;
+    cout << "  -U, read the input with plain read() instead of io_uring" << endl;
+    cout << "  -t, report elapsed time on stderr" << endl;
+    cout << "  -p, report per order hardware counters (cycles, IPC, cache, branch and dTLB misses) of the" << endl;
+    cout << "      parse, match and add phases on stderr, wall time only if counters are unavailable" << endl;
+    cout << "  -r, write a csv of every trader's position, buy/sell quantity, notional and VWAP, fill count and" << endl;
+    cout << "      realized P&L (average cost, in cents) to the file" << endl;
     cout << endl;
 }
 
 int main( int argc, char** argv )
 {
     string infile = "../data/orders.csv";
+    string indir, manifest, archive;
+    int nThreads = 0;
+    int arenaMB = 0;
+    char engineOpt = 0; // last single engine option given, batch mode has none
+    Matching::EngineOptions options;
     int opt;
-    while ((opt = getopt(argc, argv, "i:")) != -1) {
+    while ((opt = getopt(argc, argv, "i:d:m:j:z:A:HPLc:C:Utpr:")) != -1) {
         switch(opt) {
         case 'i':
             infile = optarg;
             break;
+        case 'd':
+            indir = optarg;
+            break;
+        case 'm':
+            manifest = optarg;
+            break;
+        case 'j':
+            nThreads = atoi( optarg );
+            break;
+        case 'z':
+            archive = optarg;
+            break;
+        case 'A':
+            engineOpt = 'A';
+            arenaMB = atoi( optarg );
+            break;
+        case 'H':
+            engineOpt = 'H';
+            options.m_hugePages = true;
+            break;
+        case 'P':
+            engineOpt = 'P';
+            options.m_prefault = true;
+            break;
+        case 'L':
+            engineOpt = 'L';
+            options.m_lockMemory = true;
+            break;
+        case 'c':
+            engineOpt = 'c';
+            options.m_matchCore = atoi( optarg );
+            break;
+        case 'C':
+            engineOpt = 'C';
+            options.m_ioCore = atoi( optarg );
+            break;
+        case 'U':
+            engineOpt = 'U';
+            options.m_asyncIo = false;
+            break;
+        case 't':
+            engineOpt = 't';
+            options.m_timing = true;
+            break;
+        case 'p':
+            engineOpt = 'p';
+            options.m_profile = true;
+            break;
+        case 'r':
+            engineOpt = 'r';
+            options.m_reportFile = optarg;
+            break;
         default:
             usage ();
             return -1;
         }
     }
 
+    if( !archive.empty() )
+    {
+        long nOrders = 0;
+        int status = Matching::OrderArchiveWriter::convert( infile, archive, &nOrders );
+        cout << nOrders << " orders archived" << endl;
+        return status;
+    }
+
+    if( !indir.empty() || !manifest.empty() )
+    {
+        if( engineOpt != 0 )
+        {
+            fprintf( stderr, "-%c does not apply to batch mode (-d, -m)\n", engineOpt );
+            return -1;
+        }
+        Matching::BatchRunner runner( nThreads );
+        if( ( !indir.empty() && runner.addDirectory( indir ) != 0 ) ||
+                ( !manifest.empty() && runner.addManifest( manifest ) != 0 ) )
+            return -1;
+        int status = runner.run();
+        runner.summary( cout );
+        return status;
+    }
+
+    if( arenaMB == 0 && ( options.m_hugePages || options.m_prefault || options.m_lockMemory ) )
+        arenaMB = ARENA_DEFAULT_MB;
+    options.m_arenaBytes = (size_t)arenaMB << 20;
+
     Matching::MatchingEngine engine;
+    if( engine.configure( options ) != 0 )
+    {
+        fprintf( stderr, "Engine options could not be applied, exiting\n" );
+        return -1;
+    }
     return engine.run( infile );
 }
 
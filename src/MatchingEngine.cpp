@@ -10,14 +10,19 @@
 #include <sstream>
 #include <memory>
 #include <vector>
+#include <cstdio>
 #include <cstring>
+#include <chrono>
 #include "MatchingEngine.h"
 #include "OrderBook.h"
+#include "OrderArchive.h"
+#include "ChunkReader.h"
 
 namespace Matching
 {
 
-MatchingEngine::MatchingEngine()
+MatchingEngine::MatchingEngine() : m_arena( NULL ), m_asyncIo( true ), m_ioCore( -1 ), m_timing( false ),
+        m_profiler( NULL )
 {
     m_orderBook = new OrderBook();
     vector<string> names{ TRADER };
@@ -29,59 +34,308 @@ void MatchingEngine::init( const vector<string>& names )
     m_orderBook->bookTradeForTrader( names );
 }
 
+/**
+ * Apply startup options, must be called from the matching thread before any order.
+ * Every option falls back with a warning, return -1 if any of them did
+ * */
+int MatchingEngine::configure( const EngineOptions& options )
+{
+    int status = 0;
+    m_asyncIo = options.m_asyncIo;
+    m_ioCore = options.m_ioCore;
+    m_timing = options.m_timing;
+    m_reportFile = options.m_reportFile;
+    if( options.m_profile && m_profiler == NULL )
+        m_profiler = new PerfProfiler();
+
+    if( options.m_matchCore >= 0 && pinCurrentThread( options.m_matchCore ) != 0 )
+        status = -1;
+
+    if( options.m_arenaBytes > 0 && m_arena == NULL )
+    {
+        m_arena = new Arena( options.m_arenaBytes, options.m_hugePages );
+        if( !m_arena->isValid() )
+            status = -1;
+        if( options.m_hugePages && strcmp( m_arena->getPageMode(), "4k" ) == 0 )
+            status = -1;
+        if( options.m_prefault )
+            m_arena->prefault();
+        if( options.m_lockMemory && m_arena->lock() != 0 )
+            status = -1;
+        if( m_orderBook->setArena( m_arena ) != 0 )
+        {
+            fprintf( stderr, "Order book is not empty, arena not used\n" );
+            delete m_arena;
+            m_arena = NULL;
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Execute an order, then every stop order it triggers, including cascades,
+ * in the order their stop prices were printed through
+ * */
 void MatchingEngine::processOrder( Order* order )
+{
+    execute( order );
+
+    Order* triggered;
+    while( m_orderBook->popTriggeredStop( triggered ) )
+        execute( triggered );
+
+    if( m_profiler != NULL )
+        m_profiler->switchTo( PHASE_OTHER );
+    m_orderBook->publishTopOfBook( &m_topOfBook );
+}
+
+void MatchingEngine::execute( Order* order )
 {
     int qtyToMatch = order->m_quantity;
+    if( qtyToMatch <= 0 )
+    {
+        arenaDelete( m_arena, order );
+        return;
+    }
+
+    if( order->isStop() )
+    {
+        m_orderBook->addStop( order );
+        return;
+    }
+
+    if( order->m_type == MARKET )
+        order->m_price = order->m_isBuy ? MKT_BUY_PRICE : MKT_SELL_PRICE;
+
+    // fill or kill is rejected before touching any quote if the book cannot fill it
+    if( order->m_type == FOK && !m_orderBook->canFill( order, qtyToMatch ) )
+    {
+        arenaDelete( m_arena, order );
+        return;
+    }
 
     // only match marketable order, qtyToMatch is the residual need to post on return
+    if( m_profiler != NULL )
+        m_profiler->switchTo( PHASE_MATCH );
     m_orderBook->match( order, qtyToMatch );
 
-    // post non marketable portion
+    // post non marketable portion, only limit orders rest in the book
     if( qtyToMatch > 0 )
     {
-        if( qtyToMatch != order->m_quantity )
-            order->m_quantity = qtyToMatch;
-        m_orderBook->add( order );
+        if( order->m_type != LIMIT )
+            arenaDelete( m_arena, order );
+        else
+        {
+            if( qtyToMatch != order->m_quantity )
+                order->m_quantity = qtyToMatch;
+            if( m_profiler != NULL )
+                m_profiler->switchTo( PHASE_ADD );
+            m_orderBook->add( order );
+        }
     }
 }
 
-int MatchingEngine::run( const string& inFile )
+/**
+ * Parse one csv line into an order from arena ( heap if NULL ), return NULL if it is not a valid order
+ *  e.g. 70000001,Mal,73.21,100,100001,BUY[,IOC]
+ *       70000001,Mal,73.21,100,100001,BUY,STOP,73.00
+ * */
+Order* MatchingEngine::parseOrder( const char* line, Arena* arena )
 {
+    int id, quantity, time;
+    char name[ MAX_NAME ], buySellStr[ 5 ], typeStr[ 12 ];
+    float price, stopPrice;
 
-    FILE *file = fopen( inFile.c_str(), "r");
-    if ( NULL == file ) {
-        fprintf( stderr, "Cannot open file at %s\n", inFile.c_str() );
+    int nItemsRead = sscanf( line, "%d,%31[^,],%f,%d,%d,%4[^,\r\n],%11[^,\r\n],%f",
+            &id, name, &price, &quantity, &time, buySellStr, typeStr, &stopPrice );
+    if ( nItemsRead < NCOL )
+        return NULL;
+
+    OrderType type = LIMIT;
+    if( nItemsRead > NCOL && !parseOrderType( typeStr, type ) )
+        return NULL;
+
+    // stop orders need the stop price column, the others must not have it
+    bool isStop = type == STOP || type == STOP_LIMIT;
+    if( isStop ? nItemsRead != NCOL + 2 : nItemsRead > NCOL + 1 )
+        return NULL;
+
+    bool isBuy = strcmp( BUYSTR, buySellStr ) == 0;
+    int priceInt = price * 100 + 0.5;
+    int stopPriceInt = isStop ? stopPrice * 100 + 0.5 : 0;
+
+    return arenaNew< Order >( arena, id, name, priceInt, quantity, time, isBuy, type, stopPriceInt );
+}
+
+bool MatchingEngine::parseOrderType( const char* str, OrderType& type )
+{
+    if( strcmp( str, "LIMIT" ) == 0 || strcmp( str, "GTC" ) == 0 )
+        type = LIMIT;
+    else if( strcmp( str, "IOC" ) == 0 )
+        type = IOC;
+    else if( strcmp( str, "FOK" ) == 0 )
+        type = FOK;
+    else if( strcmp( str, "MARKET" ) == 0 || strcmp( str, "MKT" ) == 0 )
+        type = MARKET;
+    else if( strcmp( str, "STOP" ) == 0 )
+        type = STOP;
+    else if( strcmp( str, "STOPLIMIT" ) == 0 )
+        type = STOP_LIMIT;
+    else
+        return false;
+    return true;
+}
+
+int MatchingEngine::run( const string& inFile )
+{
+    SessionStats stats;
+    if( replay( inFile, stats ) != 0 )
         return -1;
-    }
 
-    int id, quantity, time;
-    char name[20], buySellStr[5];
-    float price;
-    while( !feof( file ) ){
-        // 70000001,Mal,73.21,100,100001,BUY
-        int nItemsRead = fscanf( file, "%d,%[^,],%f,%d,%d,%s\n",
-                &id, name, &price, &quantity, &time, buySellStr );
-        if ( NCOL != nItemsRead)
+    if( stats.m_badLines > 0 )
+        cerr << "Bad lines: " << stats.m_badLines << endl;
+    if( m_timing )
+        cerr << "Elapsed " << stats.m_elapsedMs << " ms, " << stats.m_orders << " orders, arena " <<
+                ( m_arena != NULL ? m_arena->getPageMode() : "off" ) << ", input " <<
+                stats.m_input << endl;
+    if( m_profiler != NULL )
+        m_profiler->report( cerr, stats.m_orders );
+
+    if( !m_reportFile.empty() )
+    {
+        ofstream out( m_reportFile.c_str() );
+        if( !out )
         {
-            cout << "Bad line" << endl;
+            fprintf( stderr, "Cannot open report file %s\n", m_reportFile.c_str() );
+            return -1;
         }
+        report( out );
+    }
 
-        bool isBuy = strcmp( BUYSTR, buySellStr ) == 0;
-        int priceInt = price * 100 + 0.5;
+    string str = stats.m_exposure >= 0 ? "L" : "S";
+    cout << str << endl;
+    cout << abs( stats.m_exposure ) << endl;
 
-        Order* order = new Order( id, name, priceInt, quantity, time, isBuy );
-        processOrder( order );
+    return 0;
+}
+
+/**
+ * Write one csv row per trader account: registered traders first (see init()),
+ * with zero rows if they never traded, then the others in order of first fill
+ *  prices in cents, VWAP rounded to the cent
+ * */
+void MatchingEngine::report( ostream& out ) const
+{
+    out << "trader,position,buy_qty,buy_notional,buy_vwap,sell_qty,sell_notional,sell_vwap,fills,realized_pnl\n";
+    char vwap[ 2 ][ 32 ];
+    for( const TraderAccount& account : *m_orderBook->getAccounts() )
+    {
+        snprintf( vwap[ 0 ], sizeof( vwap[ 0 ] ), "%.0f", account.getBuyVwap() );
+        snprintf( vwap[ 1 ], sizeof( vwap[ 1 ] ), "%.0f", account.getSellVwap() );
+        out << account.m_name << ',' << account.m_position << ',' <<
+                account.m_buyQty << ',' << account.m_buyNotional << ',' << vwap[ 0 ] << ',' <<
+                account.m_sellQty << ',' << account.m_sellNotional << ',' << vwap[ 1 ] << ',' <<
+                account.m_fills << ',' << account.m_realizedPnl << '\n';
     }
+    out.flush();
+}
 
-    int exposure = m_orderBook->getTraderExposure( TRADER );
-    string str = exposure >= 0 ? "L" : "S";
-    cout << str << endl;
-    cout << abs( exposure ) << endl;
+/**
+ * Replay an order file, csv or archive, through this engine without printing,
+ * so that several engines can replay independent files concurrently
+ * */
+int MatchingEngine::replay( const string& inFile, SessionStats& stats )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    stats.m_file = inFile;
+
+    int status = OrderArchiveReader::isArchive( inFile ) ?
+            replayArchive( inFile, stats ) : replayCsv( inFile, stats );
+    if( m_profiler != NULL )
+        m_profiler->stop();
+    if( status != 0 )
+    {
+        stats.m_status = -1;
+        return -1;
+    }
+
+    stats.m_exposure = m_orderBook->getTraderExposure( TRADER );
+    stats.m_elapsedMs = chrono::duration< double, milli >( chrono::steady_clock::now() - start ).count();
 
     return 0;
 }
 
+/**
+ * Stream the csv through a LineReader, which keeps reads in flight with
+ * io_uring so that parsing does not wait on I/O
+ * */
+int MatchingEngine::replayCsv( const string& inFile, SessionStats& stats )
+{
+    LineReader reader;
+    if( reader.open( inFile, m_asyncIo, m_ioCore ) != 0 )
+        return -1;
+    stats.m_input = reader.isAsync() ? "io_uring" : "read";
+
+    char line[ MAX_LINE ];
+    for( ;; )
+    {
+        if( m_profiler != NULL )
+            m_profiler->switchTo( PHASE_PARSE );
+        if( !reader.next( line, MAX_LINE ) )
+            break;
+
+        if( line[ 0 ] == '\0' || line[ 0 ] == '\r' )
+            continue;
+
+        // the prefix of an overlong line may still parse, it is bad as a whole
+        Order* order = reader.isTruncated() ? NULL : parseOrder( line, m_arena );
+        if( NULL == order )
+        {
+            ++stats.m_badLines;
+            continue;
+        }
+
+        processOrder( order );
+        ++stats.m_orders;
+    }
+
+    return 0;
 }
 
+/**
+ * Stream the archive block by block, a truncated or corrupt archive fails the
+ * session, the orders of the blocks before it have been processed
+ * */
+int MatchingEngine::replayArchive( const string& inFile, SessionStats& stats )
+{
+    OrderArchiveReader reader;
+    if( reader.open( inFile ) != 0 )
+        return -1;
+    stats.m_input = "archive";
 
+    ArchiveBlock block;
+    for( ;; )
+    {
+        if( m_profiler != NULL )
+            m_profiler->switchTo( PHASE_PARSE );
+        if( !reader.nextBlock( block ) )
+            break;
 
+        for( size_t row = 0; row < block.size(); ++row )
+        {
+            processOrder( block.newOrder( row, m_arena ) );
+            ++stats.m_orders;
+        }
+    }
+
+    if( reader.isCorrupt() )
+    {
+        fprintf( stderr, "Truncated or corrupt order archive %s after %ld orders\n", inFile.c_str(), stats.m_orders );
+        return -1;
+    }
+    return 0;
+}
+
+}
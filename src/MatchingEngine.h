@@ -9,30 +9,94 @@
 #define MATCHINGENGINE_H_
 
 #include "OrderBook.h"
+#include "PerfProfiler.h"
 
 namespace Matching
 {
 
 #define BUYSTR "BUY"
 #define TRADER "Kaylee"
-#define NCOL 6
+#define NCOL 6 // mandatory columns, optional order type and stop price columns may follow
+#define MAX_LINE 256
+#define MAX_NAME 32
+
+/**
+ * Outcome of replaying one order file
+ * */
+typedef struct SessionStats
+{
+    string m_file;
+    int m_status; // 0 on success, -1 if the file cannot be opened
+    int m_exposure; // net position of TRADER
+    long m_orders;
+    long m_badLines;
+    double m_elapsedMs;
+    const char* m_input; // how the input was read: "archive", "io_uring" or "read"
+
+    SessionStats() : m_status( 0 ), m_exposure( 0 ), m_orders( 0 ), m_badLines( 0 ), m_elapsedMs( 0 ),
+            m_input( "none" ) {}
+} SessionStats;
+
+/**
+ * Engine startup options, see Main.cpp usage()
+ * */
+typedef struct EngineOptions
+{
+    size_t m_arenaBytes; // 0: book memory from the heap
+    bool m_hugePages; // back the arena with 2MB pages
+    bool m_prefault; // touch the whole arena at startup
+    bool m_lockMemory; // mlock the arena
+    int m_matchCore; // pin the matching thread, -1: not pinned
+    bool m_asyncIo; // stream csv input with io_uring when available
+    int m_ioCore; // pin the io_uring submission thread, -1: no submission thread
+    bool m_timing; // report elapsed time of run()
+    bool m_profile; // report hardware counters per phase of run()
+    string m_reportFile; // write the trader accounts report of run() there, empty: no report
+
+    EngineOptions() : m_arenaBytes( 0 ), m_hugePages( false ), m_prefault( false ), m_lockMemory( false ),
+            m_matchCore( -1 ), m_asyncIo( true ), m_ioCore( -1 ), m_timing( false ), m_profile( false ) {}
+} EngineOptions;
 
 class MatchingEngine
 {
 private:
     OrderBook* m_orderBook;
+    Arena* m_arena; // memory of m_orderBook and the orders parsed for it, if configured
+    bool m_asyncIo;
+    int m_ioCore;
+    bool m_timing;
+    PerfProfiler* m_profiler; // NULL unless profiling
+    string m_reportFile;
+    TopOfBook m_topOfBook; // published after each order for concurrent readers
+
+    void execute( Order* order );
+    int replayCsv( const string& inFile, SessionStats& stats );
+    int replayArchive( const string& inFile, SessionStats& stats );
 
 public:
     MatchingEngine();
-    virtual ~MatchingEngine() { clean(); }
+    virtual ~MatchingEngine() { clean(); delete m_profiler; delete m_arena; }
+
+    // keep m_topOfBook cache line aligned on the heap too
+    static void* operator new( size_t n ) { return TopOfBook::alignedAllocate( n ); }
+    static void operator delete( void* p ) { free( p ); }
 
     const OrderBook* getOrderBook() const { return m_orderBook; }
+    const TopOfBook& getTopOfBook() const { return m_topOfBook; }
 
     void init( const vector<string>& names );
+    int configure( const EngineOptions& options );
+    const Arena* getArena() const { return m_arena; }
+    const PerfProfiler* getProfiler() const { return m_profiler; }
     void clean() { delete m_orderBook; }
     int run( const string& inFile );
+    int replay( const string& inFile, SessionStats& stats );
+    void report( ostream& out ) const;
 
     void processOrder( Order* order );
+
+    static Order* parseOrder( const char* line, Arena* arena = NULL );
+    static bool parseOrderType( const char* str, OrderType& type );
 };
 
 }
@@ -14,9 +14,25 @@ using namespace std;
 namespace Matching
 {
 
+/**
+ * Time in force / execution instruction
+ *  only LIMIT posts its residual to the book, the others cancel it
+ * */
+enum OrderType
+{
+    LIMIT,  // good till cancel limit order
+    IOC,    // immediate or cancel: match what is marketable now
+    FOK,    // fill or kill: match the whole quantity now or nothing
+    MARKET, // match at any price, price is ignored
+    STOP,   // becomes MARKET once a trade prints through the stop price
+    STOP_LIMIT // becomes LIMIT once a trade prints through the stop price
+};
+
 /**
  * Order Type
  * e.g. 70000001,Mal,73.21,100,100001,BUY
+ *      70000001,Mal,73.21,100,100001,BUY,IOC
+ *      70000001,Mal,73.21,100,100001,BUY,STOPLIMIT,73.00
  * */
 typedef struct Order
 {
@@ -24,12 +40,19 @@ typedef struct Order
     int m_price; // in cents
     int m_quantity;
     int m_time;
+    int m_stopPrice; // in cents, only for STOP and STOP_LIMIT
     bool m_isBuy;
+    OrderType m_type;
     string m_name;
+    mutable int m_account; // index of the trader account in the book, -1 until first fill
 
-    Order( int id, string name, int price, int quantity, int time, bool isBuy ) :
+    Order( int id, string name, int price, int quantity, int time, bool isBuy, OrderType type = LIMIT,
+            int stopPrice = 0 ) :
             m_id( id ), m_price( price ), m_quantity( quantity ),
-            m_time( time ), m_isBuy( isBuy ), m_name( name ) {}
+            m_time( time ), m_stopPrice( stopPrice ), m_isBuy( isBuy ), m_type( type ), m_name( name ),
+            m_account( -1 ) {}
+
+    bool isStop() const { return m_type == STOP || m_type == STOP_LIMIT; }
 } Order;
 
 inline
@@ -48,7 +71,9 @@ bool operator == ( const Order& lhs, const Order& rhs )
             lhs.m_price == rhs.m_price &&
             lhs.m_quantity == rhs.m_quantity &&
             lhs.m_time == rhs.m_time &&
-            lhs.m_isBuy == rhs.m_isBuy;
+            lhs.m_isBuy == rhs.m_isBuy &&
+            lhs.m_type == rhs.m_type &&
+            lhs.m_stopPrice == rhs.m_stopPrice;
 }
 
 inline
@@ -0,0 +1,517 @@
+/*
+ * OrderArchive.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#include <cstring>
+#include <thread>
+#include "MatchingEngine.h"
+#include "OrderArchive.h"
+
+namespace Matching
+{
+
+//----------------------------------
+// varint and zigzag coding
+//----------------------------------
+
+static inline
+void putVarint( vector< char >& out, uint32_t v )
+{
+    while( v >= 0x80 )
+    {
+        out.push_back( (char)( v | 0x80 ) );
+        v >>= 7;
+    }
+    out.push_back( (char)v );
+}
+
+static inline
+bool getVarint( const unsigned char*& p, const unsigned char* end, uint32_t& v )
+{
+    v = 0;
+    for( int shift = 0; shift < 35 && p != end; shift += 7 )
+    {
+        unsigned char b = *p++;
+        v |= (uint32_t)( b & 0x7f ) << shift;
+        if( !( b & 0x80 ) )
+            return true;
+    }
+    return false;
+}
+
+// deltas wrap around in 32 bits, so any int sequence round trips
+static inline
+uint32_t zigzag( uint32_t delta )
+{
+    return ( delta << 1 ) ^ ( 0 - ( delta >> 31 ) );
+}
+
+static inline
+uint32_t unzigzag( uint32_t v )
+{
+    return ( v >> 1 ) ^ ( 0 - ( v & 1 ) );
+}
+
+static
+void putDeltas( vector< char >& out, const vector< int >& values )
+{
+    uint32_t prev = 0;
+    for( int value : values )
+    {
+        putVarint( out, zigzag( (uint32_t)value - prev ) );
+        prev = (uint32_t)value;
+    }
+}
+
+static
+bool getDeltas( const unsigned char* p, const unsigned char* end, size_t n, vector< int >& values )
+{
+    values.resize( n );
+    uint32_t prev = 0, v;
+    for( size_t i = 0; i < n; ++i )
+    {
+        if( !getVarint( p, end, v ) )
+            return false;
+        prev += unzigzag( v );
+        values[ i ] = (int)prev;
+    }
+    return p == end;
+}
+
+//----------------------------------
+// ArchiveBlock
+//----------------------------------
+
+void ArchiveBlock::clear()
+{
+    m_ids.clear();
+    m_times.clear();
+    m_prices.clear();
+    m_quantities.clear();
+    m_names.clear();
+    m_dictionary.clear();
+    m_isBuy.clear();
+    m_types.clear();
+    m_stopPrices.clear();
+}
+
+void ArchiveBlock::append( const Order& order, int nameIdx )
+{
+    m_ids.push_back( order.m_id );
+    m_times.push_back( order.m_time );
+    m_prices.push_back( order.m_price );
+    m_quantities.push_back( order.m_quantity );
+    m_names.push_back( nameIdx );
+    m_isBuy.push_back( order.m_isBuy );
+    m_types.push_back( (unsigned char)order.m_type );
+    m_stopPrices.push_back( order.isStop() ? order.m_stopPrice : 0 );
+}
+
+Order* ArchiveBlock::newOrder( size_t row, Arena* arena ) const
+{
+    return arenaNew< Order >( arena, m_ids[ row ], m_dictionary[ m_names[ row ] ], m_prices[ row ], m_quantities[ row ],
+            m_times[ row ], m_isBuy[ row ], (OrderType)m_types[ row ], m_stopPrices[ row ] );
+}
+
+//----------------------------------
+// OrderArchiveWriter
+//----------------------------------
+
+OrderArchiveWriter::OrderArchiveWriter( size_t rowsPerBlock ) : m_file( NULL ), m_rowsPerBlock( rowsPerBlock )
+{
+    if( m_rowsPerBlock == 0 )
+        m_rowsPerBlock = ARCHIVE_BLOCK_ROWS;
+}
+
+int OrderArchiveWriter::open( const string& path )
+{
+    close();
+    m_file = fopen( path.c_str(), "wb" );
+    if( NULL == m_file )
+    {
+        fprintf( stderr, "Cannot open file at %s\n", path.c_str() );
+        return -1;
+    }
+
+    uint32_t header[ 2 ] = { ARCHIVE_MAGIC, ARCHIVE_VERSION };
+    return fwrite( header, sizeof( header ), 1, m_file ) == 1 ? 0 : -1;
+}
+
+int OrderArchiveWriter::append( const Order& order )
+{
+    if( NULL == m_file )
+        return -1;
+
+    pair< unordered_map< string, int >::iterator, bool > it =
+            m_nameIndex.emplace( order.m_name, (int)m_block.m_dictionary.size() );
+    if( it.second )
+        m_block.m_dictionary.push_back( order.m_name );
+    m_block.append( order, it.first->second );
+
+    if( m_block.size() >= m_rowsPerBlock )
+        return flushBlock();
+    return 0;
+}
+
+/**
+ * Encode the buffered rows as one block
+ * */
+int OrderArchiveWriter::flushBlock()
+{
+    if( m_block.size() == 0 )
+        return 0;
+
+    size_t n = m_block.size();
+    vector< char > cols[ NCOLUMN ];
+    putDeltas( cols[ COL_ID ], m_block.m_ids );
+    putDeltas( cols[ COL_TIME ], m_block.m_times );
+    putDeltas( cols[ COL_PRICE ], m_block.m_prices );
+    putDeltas( cols[ COL_QUANTITY ], m_block.m_quantities );
+
+    for( int idx : m_block.m_names )
+        putVarint( cols[ COL_NAME ], idx );
+    putVarint( cols[ COL_DICTIONARY ], m_block.m_dictionary.size() );
+    for( const string& name : m_block.m_dictionary )
+    {
+        putVarint( cols[ COL_DICTIONARY ], name.size() );
+        cols[ COL_DICTIONARY ].insert( cols[ COL_DICTIONARY ].end(), name.begin(), name.end() );
+    }
+
+    cols[ COL_SIDE ].assign( ( n + 7 ) / 8, 0 );
+    for( size_t i = 0; i < n; ++i )
+        if( m_block.m_isBuy[ i ] )
+            cols[ COL_SIDE ][ i / 8 ] |= 1 << ( i % 8 );
+
+    vector< int > stopPrices;
+    bool allLimit = true;
+    for( size_t i = 0; i < n; ++i )
+    {
+        OrderType type = (OrderType)m_block.m_types[ i ];
+        allLimit &= type == LIMIT;
+        if( type == STOP || type == STOP_LIMIT )
+            stopPrices.push_back( m_block.m_stopPrices[ i ] );
+    }
+    if( !allLimit )
+        cols[ COL_TYPE ].assign( m_block.m_types.begin(), m_block.m_types.end() );
+    putDeltas( cols[ COL_STOP_PRICE ], stopPrices );
+
+    ArchiveBlockHeader header;
+    header.m_magic = ARCHIVE_BLOCK_MAGIC;
+    header.m_nRows = n;
+    for( int col = 0; col < NCOLUMN; ++col )
+        header.m_columnBytes[ col ] = cols[ col ].size();
+
+    int status = fwrite( &header, sizeof( header ), 1, m_file ) == 1 ? 0 : -1;
+    for( int col = 0; col < NCOLUMN; ++col )
+        if( !cols[ col ].empty() && fwrite( &cols[ col ][ 0 ], cols[ col ].size(), 1, m_file ) != 1 )
+            status = -1;
+
+    m_block.clear();
+    m_nameIndex.clear();
+    return status;
+}
+
+int OrderArchiveWriter::close()
+{
+    if( NULL == m_file )
+        return 0;
+    int status = flushBlock();
+
+    ArchiveBlockHeader end;
+    memset( &end, 0, sizeof( end ) );
+    end.m_magic = ARCHIVE_END_MAGIC;
+    if( fwrite( &end, sizeof( end ), 1, m_file ) != 1 )
+        status = -1;
+    if( fclose( m_file ) != 0 )
+        status = -1;
+    m_file = NULL;
+    return status;
+}
+
+/**
+ * Archive a csv order file, bad lines are dropped
+ * */
+int OrderArchiveWriter::convert( const string& csvFile, const string& archiveFile, long* nOrders )
+{
+    FILE* in = fopen( csvFile.c_str(), "r" );
+    if( NULL == in )
+    {
+        fprintf( stderr, "Cannot open file at %s\n", csvFile.c_str() );
+        return -1;
+    }
+
+    OrderArchiveWriter writer;
+    if( writer.open( archiveFile ) != 0 )
+    {
+        fclose( in );
+        return -1;
+    }
+
+    long n = 0;
+    int status = 0;
+    char line[ MAX_LINE ];
+    while( status == 0 && fgets( line, MAX_LINE, in ) != NULL )
+    {
+        Order* order = MatchingEngine::parseOrder( line );
+        if( NULL == order )
+            continue;
+        status = writer.append( *order );
+        delete order;
+        ++n;
+    }
+    fclose( in );
+
+    if( writer.close() != 0 )
+        status = -1;
+    if( nOrders != NULL )
+        *nOrders = n;
+    return status;
+}
+
+//----------------------------------
+// OrderArchiveReader
+//----------------------------------
+
+bool OrderArchiveReader::isArchive( const string& path )
+{
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( NULL == file )
+        return false;
+    uint32_t magic = 0;
+    bool isArchive = fread( &magic, sizeof( magic ), 1, file ) == 1 && magic == ARCHIVE_MAGIC;
+    fclose( file );
+    return isArchive;
+}
+
+int OrderArchiveReader::open( const string& path )
+{
+    close();
+    m_file = fopen( path.c_str(), "rb" );
+    if( NULL == m_file )
+    {
+        fprintf( stderr, "Cannot open file at %s\n", path.c_str() );
+        return -1;
+    }
+
+    uint32_t header[ 2 ];
+    if( fread( header, sizeof( header ), 1, m_file ) != 1 ||
+            header[ 0 ] != ARCHIVE_MAGIC || header[ 1 ] != ARCHIVE_VERSION )
+    {
+        fprintf( stderr, "Not an order archive at %s\n", path.c_str() );
+        close();
+        return -1;
+    }
+
+    if( fseek( m_file, 0, SEEK_END ) != 0 || ( m_fileSize = ftell( m_file ) ) < 0 ||
+            fseek( m_file, sizeof( header ), SEEK_SET ) != 0 )
+    {
+        fprintf( stderr, "Cannot seek in %s\n", path.c_str() );
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void OrderArchiveReader::close()
+{
+    if( m_file != NULL )
+        fclose( m_file );
+    m_file = NULL;
+    m_corrupt = false;
+}
+
+/**
+ * Streaming read: decode the next block, false at the end of the archive or on a
+ * corrupt block, in which case isCorrupt() is set: a bad magic, a payload larger
+ * than the rest of the file, a short read, a block that does not decode, or
+ * the end of the file before the end header
+ * */
+bool OrderArchiveReader::nextBlock( ArchiveBlock& block )
+{
+    if( NULL == m_file || m_corrupt )
+        return false;
+
+    ArchiveBlockHeader header;
+    if( fread( &header, sizeof( header ), 1, m_file ) != 1 )
+    {
+        m_corrupt = true;
+        return false;
+    }
+    if( header.m_magic == ARCHIVE_END_MAGIC )
+        return false;
+
+    long pos = ftell( m_file );
+    if( header.m_magic != ARCHIVE_BLOCK_MAGIC || pos < 0 ||
+            header.getPayloadBytes() > (uint64_t)( m_fileSize - pos ) )
+    {
+        m_corrupt = true;
+        return false;
+    }
+
+    m_buf.resize( header.getPayloadBytes() );
+    if( ( !m_buf.empty() && fread( &m_buf[ 0 ], m_buf.size(), 1, m_file ) != 1 ) ||
+            !decodeBlock( header, m_buf.data(), block ) )
+    {
+        m_corrupt = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Offset of every block, by hopping from header to header without decoding
+ *  false if the archive is truncated or a header is corrupt
+ * */
+bool OrderArchiveReader::readBlockOffsets( vector< long >& offsets )
+{
+    offsets.clear();
+    if( NULL == m_file || fseek( m_file, 2 * sizeof( uint32_t ), SEEK_SET ) != 0 )
+        return false;
+
+    ArchiveBlockHeader header;
+    long offset = ftell( m_file );
+    while( fread( &header, sizeof( header ), 1, m_file ) == 1 )
+    {
+        if( header.m_magic == ARCHIVE_END_MAGIC )
+            return true;
+        if( header.m_magic != ARCHIVE_BLOCK_MAGIC )
+            break;
+        offsets.push_back( offset );
+        offset += sizeof( header ) + header.getPayloadBytes();
+        if( offset > m_fileSize || fseek( m_file, offset, SEEK_SET ) != 0 )
+            break;
+    }
+    m_corrupt = true;
+    return false;
+}
+
+bool OrderArchiveReader::readBlockAt( long offset, ArchiveBlock& block )
+{
+    if( NULL == m_file || fseek( m_file, offset, SEEK_SET ) != 0 )
+        return false;
+    return nextBlock( block );
+}
+
+/**
+ * Decode one block payload, thread safe
+ * */
+bool OrderArchiveReader::decodeBlock( const ArchiveBlockHeader& header, const char* payload, ArchiveBlock& block )
+{
+    size_t n = header.m_nRows;
+    const unsigned char* cols[ NCOLUMN + 1 ];
+    cols[ 0 ] = (const unsigned char*)payload;
+    for( int col = 0; col < NCOLUMN; ++col )
+        cols[ col + 1 ] = cols[ col ] + header.m_columnBytes[ col ];
+
+    block.clear();
+    if( !getDeltas( cols[ COL_ID ], cols[ COL_ID + 1 ], n, block.m_ids ) ||
+            !getDeltas( cols[ COL_TIME ], cols[ COL_TIME + 1 ], n, block.m_times ) ||
+            !getDeltas( cols[ COL_PRICE ], cols[ COL_PRICE + 1 ], n, block.m_prices ) ||
+            !getDeltas( cols[ COL_QUANTITY ], cols[ COL_QUANTITY + 1 ], n, block.m_quantities ) )
+        return false;
+
+    // dictionary
+    const unsigned char* p = cols[ COL_DICTIONARY ];
+    const unsigned char* end = cols[ COL_DICTIONARY + 1 ];
+    uint32_t nNames, len;
+    if( !getVarint( p, end, nNames ) )
+        return false;
+    block.m_dictionary.resize( nNames );
+    for( uint32_t i = 0; i < nNames; ++i )
+    {
+        if( !getVarint( p, end, len ) || len > (size_t)( end - p ) )
+            return false;
+        block.m_dictionary[ i ].assign( (const char*)p, len );
+        p += len;
+    }
+
+    p = cols[ COL_NAME ];
+    end = cols[ COL_NAME + 1 ];
+    block.m_names.resize( n );
+    for( size_t i = 0; i < n; ++i )
+    {
+        uint32_t idx;
+        if( !getVarint( p, end, idx ) || idx >= nNames )
+            return false;
+        block.m_names[ i ] = idx;
+    }
+
+    if( header.m_columnBytes[ COL_SIDE ] != ( n + 7 ) / 8 )
+        return false;
+    p = cols[ COL_SIDE ];
+    block.m_isBuy.resize( n );
+    for( size_t i = 0; i < n; ++i )
+        block.m_isBuy[ i ] = ( p[ i / 8 ] >> ( i % 8 ) ) & 1;
+
+    size_t nStops = 0;
+    if( header.m_columnBytes[ COL_TYPE ] == 0 )
+        block.m_types.assign( n, LIMIT );
+    else if( header.m_columnBytes[ COL_TYPE ] == n )
+    {
+        block.m_types.assign( cols[ COL_TYPE ], cols[ COL_TYPE + 1 ] );
+        for( unsigned char type : block.m_types )
+        {
+            if( type > STOP_LIMIT )
+                return false;
+            nStops += type == STOP || type == STOP_LIMIT;
+        }
+    }
+    else
+        return false;
+
+    vector< int > stopPrices;
+    if( !getDeltas( cols[ COL_STOP_PRICE ], cols[ COL_STOP_PRICE + 1 ], nStops, stopPrices ) )
+        return false;
+    block.m_stopPrices.assign( n, 0 );
+    for( size_t i = 0, s = 0; s < nStops; ++i )
+        if( block.m_types[ i ] == STOP || block.m_types[ i ] == STOP_LIMIT )
+            block.m_stopPrices[ i ] = stopPrices[ s++ ];
+
+    return true;
+}
+
+/**
+ * Decode every block of the archive on nThreads threads, each with its own file handle
+ * */
+int OrderArchiveReader::decodeParallel( const string& path, int nThreads, vector< ArchiveBlock >& blocks )
+{
+    vector< long > offsets;
+    {
+        OrderArchiveReader reader;
+        if( reader.open( path ) != 0 || !reader.readBlockOffsets( offsets ) )
+            return -1;
+    }
+    blocks.assign( offsets.size(), ArchiveBlock() );
+    if( nThreads <= 0 )
+        nThreads = 1;
+
+    vector< int > status( nThreads, 0 );
+    vector< thread > workers;
+    for( int t = 0; t < nThreads; ++t )
+    {
+        workers.push_back( thread( [ &, t ]()
+        {
+            OrderArchiveReader reader;
+            if( reader.open( path ) != 0 )
+            {
+                status[ t ] = -1;
+                return;
+            }
+            for( size_t i = t; i < offsets.size(); i += nThreads )
+                if( !reader.readBlockAt( offsets[ i ], blocks[ i ] ) )
+                    status[ t ] = -1;
+        } ) );
+    }
+    for( thread& worker : workers )
+        worker.join();
+
+    for( int s : status )
+        if( s != 0 )
+            return -1;
+    return 0;
+}
+
+}
@@ -0,0 +1,147 @@
+/*
+ * OrderArchive.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef ORDERARCHIVE_H_
+#define ORDERARCHIVE_H_
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Arena.h"
+#include "Order.h"
+using namespace std;
+
+namespace Matching
+{
+
+#define ARCHIVE_MAGIC 0x5241454d // "MEAR"
+#define ARCHIVE_BLOCK_MAGIC 0x4b42454d // "MEBK"
+#define ARCHIVE_END_MAGIC 0x444e454d // "MEND", header of the empty block closing the archive
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_BLOCK_ROWS 65536
+
+/**
+ * Columns of an archive block, stored one after the other in this order
+ * */
+enum ArchiveColumn
+{
+    COL_ID,         // zigzag varint of the delta to the previous row
+    COL_TIME,       // zigzag varint delta
+    COL_PRICE,      // zigzag varint delta
+    COL_QUANTITY,   // zigzag varint delta
+    COL_NAME,       // varint index into the block dictionary
+    COL_DICTIONARY, // varint count, then varint length and bytes of each trader name
+    COL_SIDE,       // 1 bit per row, 1 for buy
+    COL_TYPE,       // 1 byte per row, empty if every row is LIMIT
+    COL_STOP_PRICE, // zigzag varint delta, stop rows only
+    NCOLUMN
+};
+
+/**
+ * Fixed size header in front of each block. Blocks are self contained, deltas
+ * restart from 0 and the dictionary is per block, so a block can be decoded
+ * without any other, streamed in order, or decoded in parallel after skipping
+ * over the headers. Headers are written as is, in host byte order; an archive
+ * from a host of the other byte order is rejected by its magic number
+ * */
+typedef struct ArchiveBlockHeader
+{
+    uint32_t m_magic;
+    uint32_t m_nRows;
+    uint32_t m_columnBytes[ NCOLUMN ];
+
+    uint64_t getPayloadBytes() const
+    {
+        uint64_t bytes = 0;
+        for( int col = 0; col < NCOLUMN; ++col )
+            bytes += m_columnBytes[ col ];
+        return bytes;
+    }
+} ArchiveBlockHeader;
+
+/**
+ * Decoded columns of one block
+ * */
+typedef struct ArchiveBlock
+{
+    vector< int > m_ids;
+    vector< int > m_times;
+    vector< int > m_prices;
+    vector< int > m_quantities;
+    vector< int > m_names; // index into m_dictionary
+    vector< string > m_dictionary;
+    vector< bool > m_isBuy;
+    vector< unsigned char > m_types; // OrderType
+    vector< int > m_stopPrices; // 0 for non stop rows
+
+    size_t size() const { return m_ids.size(); }
+    void clear();
+    void append( const Order& order, int nameIdx );
+    Order* newOrder( size_t row, Arena* arena = NULL ) const; // from arena, heap if NULL
+} ArchiveBlock;
+
+/**
+ * Columnar, delta and varint encoded archive of an order file
+ *  layout: ARCHIVE_MAGIC, ARCHIVE_VERSION, then blocks of up to rowsPerBlock rows,
+ *  then an ARCHIVE_END_MAGIC header, so that a truncated archive is detected
+ * */
+class OrderArchiveWriter
+{
+private:
+    FILE* m_file;
+    size_t m_rowsPerBlock;
+    ArchiveBlock m_block;
+    unordered_map< string, int > m_nameIndex; // trader name to m_block dictionary index
+
+    int flushBlock();
+
+public:
+    OrderArchiveWriter( size_t rowsPerBlock = ARCHIVE_BLOCK_ROWS );
+    virtual ~OrderArchiveWriter() { close(); }
+
+    int open( const string& path );
+    int append( const Order& order );
+    int close();
+
+    static int convert( const string& csvFile, const string& archiveFile, long* nOrders = NULL );
+};
+
+/**
+ * nextBlock() returns false both at the end of the archive and on a truncated or
+ * corrupt block, isCorrupt() tells them apart, like feof() and ferror()
+ * */
+class OrderArchiveReader
+{
+private:
+    FILE* m_file;
+    long m_fileSize;
+    bool m_corrupt;
+    vector< char > m_buf;
+
+public:
+    OrderArchiveReader() : m_file( NULL ), m_fileSize( 0 ), m_corrupt( false ) {}
+    virtual ~OrderArchiveReader() { close(); }
+
+    int open( const string& path );
+    void close();
+
+    bool isCorrupt() const { return m_corrupt; }
+
+    bool nextBlock( ArchiveBlock& block );
+    bool readBlockOffsets( vector< long >& offsets );
+    bool readBlockAt( long offset, ArchiveBlock& block );
+
+    static bool isArchive( const string& path );
+    static bool decodeBlock( const ArchiveBlockHeader& header, const char* payload, ArchiveBlock& block );
+    static int decodeParallel( const string& path, int nThreads, vector< ArchiveBlock >& blocks );
+};
+
+}
+
+#endif /* ORDERARCHIVE_H_ */
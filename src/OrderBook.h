@@ -10,11 +10,15 @@
 
 #include <map>
 #include <unordered_map>
+#include <deque>
 #include <set>
 #include <vector>
 #include <limits>
 #include <iostream>
+#include "Arena.h"
 #include "Order.h"
+#include "TopOfBook.h"
+#include "TraderAccount.h"
 using namespace std;
 
 namespace Matching
@@ -22,6 +26,8 @@ namespace Matching
 
 #define INAN std::numeric_limits<int>::min()
 #define IS_VALID( x ) ( x != INAN )
+#define MKT_BUY_PRICE std::numeric_limits<int>::max()
+#define MKT_SELL_PRICE ( std::numeric_limits<int>::min() + 1 ) // distinct from INAN
 
 class PriceNode;
 
@@ -42,15 +48,20 @@ struct OrderSizeTimeComparator
 };
 
 typedef PriceNode* PriceNodePtr;
-typedef map< int, PriceNodePtr > PriceTree;
-typedef map< int, PriceNodePtr >::iterator PriceTreeIt;
-typedef map< int, PriceNodePtr >::reverse_iterator PriceTreeRevIt;
-typedef unordered_map< int, PriceNodePtr > PriceToNodeMap;
-typedef unordered_map< int, PriceNodePtr >::iterator PriceToNodeMapIt;
-typedef set< Order*, OrderSizeTimeComparator > OrderTree;
-typedef set< Order*, OrderSizeTimeComparator >::iterator OrderTreeIt;
+// book containers draw their nodes from the owning book's Arena, heap if it has none
+typedef map< int, PriceNodePtr, less< int >, ArenaAllocator< pair< const int, PriceNodePtr > > > PriceTree;
+typedef PriceTree::iterator PriceTreeIt;
+typedef PriceTree::reverse_iterator PriceTreeRevIt;
+typedef unordered_map< int, PriceNodePtr, hash< int >, equal_to< int >,
+        ArenaAllocator< pair< const int, PriceNodePtr > > > PriceToNodeMap;
+typedef PriceToNodeMap::iterator PriceToNodeMapIt;
+typedef set< Order*, OrderSizeTimeComparator, ArenaAllocator< Order* > > OrderTree;
+typedef OrderTree::iterator OrderTreeIt;
+typedef multimap< int, Order*, less< int >, ArenaAllocator< pair< const int, Order* > > > StopTree; // equal keys keep arrival order
+typedef StopTree::iterator StopTreeIt;
 typedef unordered_map< string, int > AccountMap;
 typedef unordered_map< string, int >::iterator AccountMapIt;
+typedef vector< TraderAccount > AccountList;
 
 /**
  * Node in bid or ask binary sorted tree in OrderBook
@@ -60,18 +71,27 @@ class PriceNode
 {
 private:
     int m_price;
-    set< Order*, OrderSizeTimeComparator >* m_orderTree;
+    int m_quantity; // aggregate quantity of all quotes in this price level
+    OrderTree* m_orderTree;
+    Arena* m_arena; // of the quotes and the order tree nodes, NULL for heap
 
 public:
 
-    PriceNode() : m_price( INAN ), m_orderTree( NULL ) {}
-    PriceNode( int price ) : m_price( price ) { m_orderTree = new OrderTree(); }
+    PriceNode() : m_price( INAN ), m_quantity( 0 ), m_orderTree( NULL ), m_arena( NULL ) {}
+    PriceNode( int price, Arena* arena = NULL ) : m_price( price ), m_quantity( 0 ), m_arena( arena )
+    {
+        m_orderTree = new OrderTree( OrderSizeTimeComparator(), ArenaAllocator< Order* >( arena ) );
+    }
     void clean();
     virtual ~PriceNode() { clean(); }
 
     int getPrice() const { return m_price; }
+    int getQuantity() const { return m_quantity; }
     OrderTree*& getOrderTree() { return m_orderTree; }
-    void insertOrder( Order* order ) { m_orderTree->emplace( order ); }
+    const OrderTree* getOrderTree() const { return m_orderTree; }
+    PriceNode* clone() const;
+    void insertOrder( Order* order ) { m_orderTree->emplace( order ); m_quantity += order->m_quantity; }
+    void reduceQuantity( int qty ) { m_quantity -= qty; }
 
     friend ostream& operator << ( ostream& out, const PriceNode& priceNode );
 };
@@ -95,35 +115,73 @@ class OrderBook
 private:
     // binary sorted tree for indexing bid and ask orders within order book
     // PriceNode contains all quotes in size>time order using another BST for that price level
-    map< int, PriceNodePtr >* m_bidTree; // < price, LimitPriceNode >
-    map< int, PriceNodePtr >* m_askTree;
+    PriceTree* m_bidTree; // < price, LimitPriceNode >
+    PriceTree* m_askTree;
 
     // hashmap to speed up add() in order book to O(1) if price already exists
-    unordered_map< int, PriceNodePtr >* m_bidMap; // < price, LimitPriceNode >
-    unordered_map< int, PriceNodePtr >* m_askMap;
-
-    // for booking trade
-    unordered_map< string, int >* m_account;
+    PriceToNodeMap* m_bidMap; // < price, LimitPriceNode >
+    PriceToNodeMap* m_askMap;
+
+    // stop orders waiting for a trade print through their stop price
+    // keyed so that the next stop to trigger is always at begin()
+    StopTree* m_buyStops; // < stopPrice, Order >, triggers on print >= stopPrice
+    StopTree* m_sellStops; // < -stopPrice, Order >, triggers on print <= stopPrice
+    deque< Order* >* m_triggeredStops; // triggered in print order, waiting to be processed
+    int m_lastTradePrice;
+
+    // top of book is only republished when an order touched one of its levels
+    bool m_topDirty;
+    int m_bidEdge; // worst published bid, lowest int while fewer than TOB_DEPTH levels
+    int m_askEdge; // worst published ask, highest int while fewer than TOB_DEPTH levels
+
+    // for booking trade, accounts are contiguous so a report is a linear scan
+    AccountList* m_accounts;
+    AccountMap* m_accountIndex; // < name, index in m_accounts >
+
+    // source of price nodes and container nodes, NULL for heap; resting orders
+    // may come from either, each is released to where it came from
+    Arena* m_arena;
+
+    void createContainers();
+    void destroyContainers();
+    void triggerStops( int tradePrice );
+    int resolveAccount( const Order* order );
 
 public:
-    OrderBook();
+    OrderBook( Arena* arena = NULL );
     virtual ~OrderBook();
 
+    int setArena( Arena* arena );
+    Arena* getArena() const { return m_arena; }
+
     void add( Order* order );
     void match( const Order* order, int& qtyToMatch );
     void match( OrderTreeIt it, const Order* order, int& qtyToMatch, OrderTree* quotes, int bestPrice );
 
     PriceTree*& getBidTree() { return m_bidTree; }
     PriceTree*& getAskTree() { return m_askTree; }
+    const PriceTree* getBidTree() const { return m_bidTree; }
+    const PriceTree* getAskTree() const { return m_askTree; }
 
     PriceToNodeMap*& getAskMap() { return m_askMap; }
     PriceToNodeMap*& getBidMap() { return m_bidMap; }
+    const PriceToNodeMap* getAskMap() const { return m_askMap; }
+    const PriceToNodeMap* getBidMap() const { return m_bidMap; }
+
+    bool isMarketable( const Order* order, int bestPrice, bool isBuy ) const;
+    bool canFill( const Order* order, int qty ) const;
+
+    void addStop( Order* order );
+    bool popTriggeredStop( Order*& order );
+    int getLastTradePrice() const { return m_lastTradePrice; }
 
-    bool isMarketable( const Order* order, int bestPrice, bool isBuy );
+    void publishTopOfBook( TopOfBook* topOfBook );
 
-    void bookTrade( int execQty, const string& buyer, const string& seller );
+    void bookTrade( int execQty, int price, const Order* buyer, const Order* seller );
     void bookTradeForTrader( const vector< string >& names );
-    int getTraderExposure( const string& name );
+    int getTraderExposure( const string& name ) const;
+    const TraderAccount* getAccount( const string& name ) const;
+    const AccountList* getAccounts() const { return m_accounts; }
 
     friend ostream& operator << ( ostream& out, const OrderBook& book );
 };
@@ -159,41 +217,106 @@ inline
 void PriceNode::clean()
 {
     for( OrderTreeIt it = m_orderTree->begin(); it != m_orderTree->end(); ++it )
-        delete *it;
+        arenaDelete( m_arena, *it );
     delete m_orderTree;
 }
 
+/**
+ * Deep copy of the level, quotes included, on the heap
+ *  time: O(K), K the number of quotes in the level
+ * */
+inline
+PriceNode* PriceNode::clone() const
+{
+    PriceNode* node = new PriceNode( m_price );
+    for( OrderTreeIt it = m_orderTree->begin(); it != m_orderTree->end(); ++it )
+        node->insertOrder( new Order( **it ) );
+    return node;
+}
+
 //----------------------------------
 // OrderBook
 //----------------------------------
 
 inline
-OrderBook::OrderBook()
+OrderBook::OrderBook( Arena* arena ) : m_arena( arena )
 {
-    m_bidTree = new PriceTree();
-    m_askTree = new PriceTree();
-    m_bidMap = new PriceToNodeMap();
-    m_askMap = new PriceToNodeMap();
-    m_account = new AccountMap();
+    createContainers();
+    m_triggeredStops = new deque< Order* >();
+    m_lastTradePrice = INAN;
+    m_topDirty = false;
+    m_bidEdge = numeric_limits< int >::min();
+    m_askEdge = numeric_limits< int >::max();
+    m_accounts = new AccountList();
+    m_accountIndex = new AccountMap();
 }
 
 inline
 OrderBook::~OrderBook()
 {
     for( PriceTreeIt it = m_bidTree->begin(); it != m_bidTree->end(); ++it )
-        delete it->second;
+        arenaDelete( m_arena, it->second );
     for( PriceTreeIt it = m_askTree->begin(); it != m_askTree->end(); ++it )
-        delete it->second;
+        arenaDelete( m_arena, it->second );
+
+    for( StopTreeIt it = m_buyStops->begin(); it != m_buyStops->end(); ++it )
+        arenaDelete( m_arena, it->second );
+    for( StopTreeIt it = m_sellStops->begin(); it != m_sellStops->end(); ++it )
+        arenaDelete( m_arena, it->second );
+    for( Order* order : *m_triggeredStops )
+        arenaDelete( m_arena, order );
+
+    destroyContainers();
+    delete m_triggeredStops;
+    delete m_accounts;
+    delete m_accountIndex;
+}
+
+inline
+void OrderBook::createContainers()
+{
+    ArenaAllocator< pair< const int, PriceNodePtr > > nodeAlloc( m_arena );
+    ArenaAllocator< pair< const int, Order* > > stopAlloc( m_arena );
+    m_bidTree = new PriceTree( less< int >(), nodeAlloc );
+    m_askTree = new PriceTree( less< int >(), nodeAlloc );
+    m_bidMap = new PriceToNodeMap( 0, hash< int >(), equal_to< int >(), nodeAlloc );
+    m_askMap = new PriceToNodeMap( 0, hash< int >(), equal_to< int >(), nodeAlloc );
+    m_buyStops = new StopTree( less< int >(), stopAlloc );
+    m_sellStops = new StopTree( less< int >(), stopAlloc );
+}
 
+inline
+void OrderBook::destroyContainers()
+{
     delete m_bidTree;
     delete m_askTree;
+    delete m_buyStops;
+    delete m_sellStops;
     delete m_bidMap;
     delete m_askMap;
-    delete m_account;
+}
+
+/**
+ * Move the book onto arena, NULL for heap
+ *  Only an empty book can move, its containers are rebuilt on the new source;
+ *  returns -1 if orders are resting or waiting.
+ *  The arena must outlive the book.
+ * */
+inline
+int OrderBook::setArena( Arena* arena )
+{
+    if( !m_bidTree->empty() || !m_askTree->empty() || !m_buyStops->empty() ||
+            !m_sellStops->empty() || !m_triggeredStops->empty() )
+        return -1;
+
+    destroyContainers();
+    m_arena = arena;
+    createContainers();
+    return 0;
 }
 
 inline
-bool OrderBook::isMarketable( const Order* order, int bestPrice, bool isBuy )
+bool OrderBook::isMarketable( const Order* order, int bestPrice, bool isBuy ) const
 {
     if( isBuy )
         return order->m_price >= bestPrice;
@@ -201,6 +324,30 @@ bool OrderBook::isMarketable( const Order* order, int bestPrice, bool isBuy )
         return order->m_price <= bestPrice;
 }
 
+/**
+ * Fill or kill feasibility:
+ *  Whether the opposite side holds at least qty at marketable prices, using the
+ *  aggregate level quantities only, without touching any quote
+ *  time: O(L), L the number of marketable price levels needed
+ * */
+inline
+bool OrderBook::canFill( const Order* order, int qty ) const
+{
+    if( order->m_isBuy )
+    {
+        for( PriceTreeIt it = m_askTree->begin();
+                it != m_askTree->end() && qty > 0 && isMarketable( order, it->first, true ); ++it )
+            qty -= it->second->getQuantity();
+    }
+    else
+    {
+        for( PriceTreeRevIt it = m_bidTree->rbegin();
+                it != m_bidTree->rend() && qty > 0 && isMarketable( order, it->first, false ); ++it )
+            qty -= it->second->getQuantity();
+    }
+    return qty <= 0;
+}
+
 /**
  * Marketable order handling:
  *  Remove liquidity to the other side of the book given and order
@@ -216,20 +363,27 @@ void OrderBook::match( const Order* order, int& qtyToMatch )
     {
         for( PriceTreeIt itBestPrice = m_askTree->begin();
                 itBestPrice != m_askTree->end() &&
-                isMarketable( order, m_askTree->begin()->first, order->m_isBuy ) &&
-                qtyToMatch > 0; )
+                qtyToMatch > 0 &&
+                isMarketable( order, m_askTree->begin()->first, order->m_isBuy ); )
         {
             int bestPrice = itBestPrice->first;
             PriceNode* bestPriceNode = itBestPrice->second;
             OrderTree* quotes = bestPriceNode->getOrderTree();
 
             // for each order (in size > time sequence) in this price level
+            int qtyBefore = qtyToMatch;
             match( quotes->begin(), order, qtyToMatch, quotes, bestPrice );
+            bestPriceNode->reduceQuantity( qtyBefore - qtyToMatch );
+            if( qtyBefore != qtyToMatch )
+            {
+                m_topDirty = true; // matching always consumes the best level
+                triggerStops( bestPrice );
+            }
 
             // order depletes current price level
             if( quotes->empty() )
             {
-                delete bestPriceNode;
+                arenaDelete( m_arena, bestPriceNode );
                 //bestPriceNode = NULL;
                 m_askTree->erase( itBestPrice++ );
                 m_askMap->erase( bestPrice );
@@ -242,20 +396,27 @@ void OrderBook::match( const Order* order, int& qtyToMatch )
     {
         for( PriceTreeRevIt itBestPrice = m_bidTree->rbegin();
                 itBestPrice != m_bidTree->rend() &&
-                isMarketable( order, m_bidTree->rbegin()->first, order->m_isBuy ) &&
-                qtyToMatch > 0;  )
+                qtyToMatch > 0 &&
+                isMarketable( order, m_bidTree->rbegin()->first, order->m_isBuy );  )
         {
             int bestPrice = itBestPrice->first;
             PriceNode* bestPriceNode = itBestPrice->second;
             OrderTree* quotes = bestPriceNode->getOrderTree();
 
             // for each order (in size > time sequence) in this price level
+            int qtyBefore = qtyToMatch;
             match( quotes->begin(), order, qtyToMatch, quotes, bestPrice );
+            bestPriceNode->reduceQuantity( qtyBefore - qtyToMatch );
+            if( qtyBefore != qtyToMatch )
+            {
+                m_topDirty = true; // matching always consumes the best level
+                triggerStops( bestPrice );
+            }
 
             // order depletes current price level
             if( quotes->empty() )
             {
-                delete bestPriceNode;
+                arenaDelete( m_arena, bestPriceNode );
                 //bestPriceNode = NULL;
                 m_bidTree->erase( std::next( itBestPrice ).base() ); // erase in reverse iterator
                 m_bidMap->erase( bestPrice );
@@ -281,9 +442,7 @@ void OrderBook::match( OrderTreeIt it, const Order* order, int& qtyToMatch, Orde
 
         int curQty = quote->m_quantity;
         int execQty = min( curQty, qtyToMatch );
-        const string& buyer = isBuy ? order->m_name : quote->m_name;
-        const string& seller = isBuy ? quote->m_name : order->m_name;
-        bookTrade( execQty, buyer, seller );
+        bookTrade( execQty, quote->m_price, isBuy ? order : quote, isBuy ? quote : order );
         qtyToMatch -= execQty;
 
         // add residual back to order tree
@@ -293,11 +452,11 @@ void OrderBook::match( OrderTreeIt it, const Order* order, int& qtyToMatch, Orde
             quotes->emplace( quote );
         }
         else
-            delete quote;
+            arenaDelete( m_arena, quote );
     }
     // order depletes current quote
     if( qtyToMatch == 0 )
-        delete order;
+        arenaDelete( m_arena, order );
 }
 
 /**
@@ -313,49 +472,172 @@ void OrderBook::add( Order* order )
     int price = order->m_price;
     PriceTree* priceTree = isBuy ? m_bidTree : m_askTree;
     PriceToNodeMap* priceToNodeMap = isBuy ? m_bidMap : m_askMap;
+    if( isBuy ? price >= m_bidEdge : price <= m_askEdge )
+        m_topDirty = true;
 
     PriceToNodeMapIt it = priceToNodeMap->find( price );
     if( it != priceToNodeMap->end() )
-    {
-        OrderTree* quotes = it->second->getOrderTree();
-        quotes->emplace( order );
-    }
+        it->second->insertOrder( order );
     else
     {
-        PriceNode* priceNode = new PriceNode( price );
+        PriceNode* priceNode = arenaNew< PriceNode >( m_arena, price, m_arena );
         priceNode->insertOrder( order );
         priceTree->emplace( price, priceNode );
         priceToNodeMap->emplace( price, priceNode );
     }
 }
 
+/**
+ * Park a stop order until a trade prints through its stop price,
+ * trigger it right away if the last print already did
+ *  time: O(logN), N the number of resting stops
+ * */
 inline
-void OrderBook::bookTrade( int qty, const string& buyer, const string& seller )
+void OrderBook::addStop( Order* order )
 {
-    AccountMapIt it = m_account->find( buyer );
-    if( it != m_account->end() )
-        it->second += qty;
+    if( order->m_isBuy )
+        m_buyStops->emplace( order->m_stopPrice, order );
+    else
+        m_sellStops->emplace( -order->m_stopPrice, order );
 
-    it = m_account->find( seller );
-    if( it != m_account->end() )
-        it->second -= qty;
+    if( IS_VALID( m_lastTradePrice ) )
+        triggerStops( m_lastTradePrice );
+}
+
+/**
+ * Move every stop crossed by a print at tradePrice to the triggered queue,
+ * in the order the prints crossed their stop prices (farthest from this print
+ * first), then arrival order.
+ * A triggered STOP becomes MARKET and a STOP_LIMIT becomes LIMIT
+ *  time: O(k + logN), k the number of stops triggered
+ * */
+inline
+void OrderBook::triggerStops( int tradePrice )
+{
+    m_lastTradePrice = tradePrice;
+
+    while( !m_buyStops->empty() && m_buyStops->begin()->first <= tradePrice )
+    {
+        Order* order = m_buyStops->begin()->second;
+        m_buyStops->erase( m_buyStops->begin() );
+        order->m_type = order->m_type == STOP ? MARKET : LIMIT;
+        m_triggeredStops->push_back( order );
+    }
+
+    while( !m_sellStops->empty() && m_sellStops->begin()->first <= -tradePrice )
+    {
+        Order* order = m_sellStops->begin()->second;
+        m_sellStops->erase( m_sellStops->begin() );
+        order->m_type = order->m_type == STOP ? MARKET : LIMIT;
+        m_triggeredStops->push_back( order );
+    }
+}
+
+inline
+bool OrderBook::popTriggeredStop( Order*& order )
+{
+    if( m_triggeredStops->empty() )
+        return false;
+    order = m_triggeredStops->front();
+    m_triggeredStops->pop_front();
+    return true;
+}
+
+/**
+ * Publish the best TOB_DEPTH price levels of each side with their aggregate quantity,
+ * if a match or an add touched any of them since the last publish
+ *  time: O(1) if unchanged, O(TOB_DEPTH) otherwise
+ * */
+inline
+void OrderBook::publishTopOfBook( TopOfBook* topOfBook )
+{
+    if( !m_topDirty )
+        return;
+    m_topDirty = false;
+
+    TopOfBookLevels levels;
+
+    levels.m_bidDepth = 0;
+    for( PriceTreeRevIt it = m_bidTree->rbegin();
+            it != m_bidTree->rend() && levels.m_bidDepth < TOB_DEPTH; ++it, ++levels.m_bidDepth )
+    {
+        levels.m_bids[ levels.m_bidDepth ].m_price = it->first;
+        levels.m_bids[ levels.m_bidDepth ].m_quantity = it->second->getQuantity();
+    }
+
+    levels.m_askDepth = 0;
+    for( PriceTreeIt it = m_askTree->begin();
+            it != m_askTree->end() && levels.m_askDepth < TOB_DEPTH; ++it, ++levels.m_askDepth )
+    {
+        levels.m_asks[ levels.m_askDepth ].m_price = it->first;
+        levels.m_asks[ levels.m_askDepth ].m_quantity = it->second->getQuantity();
+    }
+
+    m_bidEdge = levels.m_bidDepth < TOB_DEPTH ? numeric_limits< int >::min() : levels.m_bids[ TOB_DEPTH - 1 ].m_price;
+    m_askEdge = levels.m_askDepth < TOB_DEPTH ? numeric_limits< int >::max() : levels.m_asks[ TOB_DEPTH - 1 ].m_price;
+
+    topOfBook->publish( levels );
+}
+
+/**
+ * Index of the account of order's trader, created on its first fill unless
+ * the trader was registered with bookTradeForTrader()
+ *  the index is cached in the order, so a resting quote filled many times
+ *  hashes its trader name once
+ * */
+inline
+int OrderBook::resolveAccount( const Order* order )
+{
+    int idx = order->m_account;
+    if( idx >= 0 && idx < (int)m_accounts->size() && ( *m_accounts )[ idx ].m_name == order->m_name )
+        return idx;
+
+    pair< AccountMapIt, bool > res = m_accountIndex->emplace( order->m_name, (int)m_accounts->size() );
+    if( res.second )
+        m_accounts->push_back( TraderAccount( order->m_name ) );
+    order->m_account = res.first->second;
+    return order->m_account;
+}
+
+/**
+ * Book one fill of execQty at price on both sides
+ *  time: O(1), amortized for the first fill of a trader
+ * */
+inline
+void OrderBook::bookTrade( int execQty, int price, const Order* buyer, const Order* seller )
+{
+    // resolve both before indexing, creating an account may reallocate
+    int buyIdx = resolveAccount( buyer );
+    int sellIdx = resolveAccount( seller );
+    ( *m_accounts )[ buyIdx ].fill( execQty, price, true );
+    ( *m_accounts )[ sellIdx ].fill( execQty, price, false );
 }
 
 inline
 void OrderBook::bookTradeForTrader( const vector< string >& names )
 {
     for( string name : names )
-        m_account->emplace( name, 0 );
+    {
+        if( m_accountIndex->emplace( name, (int)m_accounts->size() ).second )
+            m_accounts->push_back( TraderAccount( name ) );
+    }
 }
 
 inline
-int OrderBook::getTraderExposure( const string& name )
+const TraderAccount* OrderBook::getAccount( const string& name ) const
 {
-    AccountMapIt it = m_account->find( name );
-    if( it != m_account->end() )
-        return it->second;
+    AccountMap::const_iterator it = m_accountIndex->find( name );
+    if( it != m_accountIndex->end() )
+        return &( *m_accounts )[ it->second ];
     else
-        return 0;
+        return NULL;
+}
+
+inline
+int OrderBook::getTraderExposure( const string& name ) const
+{
+    const TraderAccount* account = getAccount( name );
+    return account != NULL ? account->m_position : 0;
 }
 
 }
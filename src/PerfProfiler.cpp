@@ -0,0 +1,424 @@
+/*
+ * PerfProfiler.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "PerfProfiler.h"
+
+namespace Matching
+{
+
+static const char* PHASE_NAMES[ NPHASE ] = { "parse", "match", "add", "other" };
+static const char* EVENT_NAMES[ NEVENT ] = { "cycles", "instr", "L1D-miss", "LLC-miss", "br-miss", "dTLB-miss" };
+static const int EVENT_GROUPS[ NEVENT ] = { 0, 0, 1, 1, 0, 1 };
+
+#define CACHE_MISS_CONFIG( cache ) \
+    ( ( cache ) | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) )
+#define PROBE_LOOPS 200000
+#define CALIBRATE_SWITCHES 1000
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int openEvent( uint32_t type, uint64_t config, int groupFd )
+{
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall( __NR_perf_event_open, &attr, 0, -1, groupFd, 0 );
+}
+
+/**
+ * Read one counter from user space, see the protocol in linux/perf_event.h
+ *  page: the mmap'd perf_event_mmap_page of the event
+ * */
+static uint64_t readPmc( const void* page )
+{
+    const volatile struct perf_event_mmap_page* pc = (const volatile struct perf_event_mmap_page*)page;
+    uint32_t seq;
+    uint64_t count;
+    do
+    {
+        seq = pc->lock;
+        __asm__ __volatile__( "" ::: "memory" );
+        uint32_t idx = pc->index;
+        count = pc->offset;
+#if defined( __x86_64__ ) || defined( __i386__ )
+        if( pc->cap_user_rdpmc && idx != 0 )
+        {
+            uint32_t lo, hi;
+            __asm__ __volatile__( "rdpmc" : "=a"( lo ), "=d"( hi ) : "c"( idx - 1 ) );
+            uint64_t pmc = ( (uint64_t)hi << 32 ) | lo;
+            uint32_t width = pc->pmc_width;
+            if( width > 0 && width < 64 )
+            {
+                // sign extend the counter width, in unsigned arithmetic
+                uint64_t sign = (uint64_t)1 << ( width - 1 );
+                pmc &= ( sign << 1 ) - 1;
+                pmc = ( pmc ^ sign ) - sign;
+            }
+            count += pmc;
+        }
+#endif
+        __asm__ __volatile__( "" ::: "memory" );
+    } while( pc->lock != seq );
+    return count;
+}
+
+PerfProfiler::PerfProfiler() : m_nOpen( 0 ), m_rdpmc( false ), m_phase( NPHASE ), m_lastNs( 0 ), m_switchNs( 0 )
+{
+    memset( m_counts, 0, sizeof( m_counts ) );
+    memset( m_ns, 0, sizeof( m_ns ) );
+    memset( m_last, 0, sizeof( m_last ) );
+    memset( m_startTimes, 0, sizeof( m_startTimes ) );
+    memset( m_enabled, 0, sizeof( m_enabled ) );
+    memset( m_running, 0, sizeof( m_running ) );
+    for( int ev = 0; ev < NEVENT; ++ev )
+    {
+        m_fds[ ev ] = -1;
+        m_pages[ ev ] = NULL;
+        m_slot[ ev ] = -1;
+    }
+
+    for( int group = 0; group < PERF_NGROUP; ++group )
+    {
+        m_leaders[ group ] = -1;
+        if( openGroup( group ) > 0 )
+            probeGroup( group );
+    }
+
+    for( int ev = 0; ev < NEVENT; ++ev )
+        if( m_fds[ ev ] >= 0 )
+            ++m_nOpen;
+    if( m_nOpen == 0 )
+        cerr << "Hardware counters unavailable, profiling wall time only" << endl;
+    else
+    {
+        mapCounters();
+        for( int group = 0; group < PERF_NGROUP; ++group )
+        {
+            if( m_leaders[ group ] == -1 )
+                continue;
+            ioctl( m_leaders[ group ], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+            ioctl( m_leaders[ group ], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+        }
+        if( m_rdpmc && !verifyRdpmc() )
+        {
+            cerr << "rdpmc disagrees with read(), reading counters with read()" << endl;
+            m_rdpmc = false;
+        }
+    }
+
+    // cost of one switch, then start from zero
+    uint64_t start = nowNs();
+    for( int i = 0; i < CALIBRATE_SWITCHES; ++i )
+        switchTo( (ProfPhase)( i % NPHASE ) );
+    stop();
+    m_switchNs = (double)( nowNs() - start ) / ( CALIBRATE_SWITCHES + 1 );
+    memset( m_counts, 0, sizeof( m_counts ) );
+    memset( m_ns, 0, sizeof( m_ns ) );
+    memset( m_enabled, 0, sizeof( m_enabled ) );
+    memset( m_running, 0, sizeof( m_running ) );
+}
+
+PerfProfiler::~PerfProfiler()
+{
+    long pageSize = sysconf( _SC_PAGESIZE );
+    for( int ev = 0; ev < NEVENT; ++ev )
+    {
+        if( m_pages[ ev ] != NULL )
+            munmap( m_pages[ ev ], pageSize );
+        if( m_fds[ ev ] >= 0 )
+            close( m_fds[ ev ] );
+    }
+}
+
+/**
+ * Open the events of one group, the first one available leads it
+ *  return the number of events opened
+ * */
+int PerfProfiler::openGroup( int group )
+{
+    const uint32_t types[ NEVENT ] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+    const uint64_t configs[ NEVENT ] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            CACHE_MISS_CONFIG( PERF_COUNT_HW_CACHE_L1D ), PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES, CACHE_MISS_CONFIG( PERF_COUNT_HW_CACHE_DTLB ) };
+
+    int nOpen = 0;
+    for( int ev = 0; ev < NEVENT; ++ev )
+    {
+        if( EVENT_GROUPS[ ev ] != group )
+            continue;
+        m_fds[ ev ] = openEvent( types[ ev ], configs[ ev ], m_leaders[ group ] );
+        if( m_fds[ ev ] < 0 )
+            continue;
+        if( m_leaders[ group ] == -1 )
+            m_leaders[ group ] = m_fds[ ev ];
+        m_slot[ ev ] = nOpen++;
+    }
+    return nOpen;
+}
+
+/**
+ * Run the group alone for a moment; while it gets no PMU time (opening succeeds
+ * even if the group can never fit), drop its last event
+ *  return whether the group, possibly reduced, runs
+ * */
+bool PerfProfiler::probeGroup( int group )
+{
+    int leader = m_leaders[ group ];
+    for( ;; )
+    {
+        ioctl( leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+        ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+        volatile int spin = 0;
+        for( int i = 0; i < PROBE_LOOPS; ++i )
+            spin = spin + i;
+        ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+
+        uint64_t values[ NEVENT ], times[ 2 ];
+        if( readGroup( group, values, times ) && times[ 1 ] > 0 )
+            return true;
+
+        // the leader has slot 0, so it is the last event only when alone
+        int last = -1;
+        for( int ev = 0; ev < NEVENT; ++ev )
+            if( EVENT_GROUPS[ ev ] == group && m_fds[ ev ] >= 0 && ( last == -1 || m_slot[ ev ] > m_slot[ last ] ) )
+                last = ev;
+        bool isLeader = m_fds[ last ] == leader;
+        close( m_fds[ last ] );
+        m_fds[ last ] = -1;
+        m_slot[ last ] = -1;
+        if( isLeader )
+            break;
+    }
+    m_leaders[ group ] = -1;
+    return false;
+}
+
+/**
+ * Map the control page of every open event, use rdpmc if all of them allow it
+ * */
+void PerfProfiler::mapCounters()
+{
+    long pageSize = sysconf( _SC_PAGESIZE );
+    bool rdpmc = true;
+    for( int ev = 0; ev < NEVENT; ++ev )
+    {
+        if( m_fds[ ev ] < 0 )
+            continue;
+        void* page = mmap( NULL, pageSize, PROT_READ, MAP_SHARED, m_fds[ ev ], 0 );
+        if( page == MAP_FAILED )
+        {
+            rdpmc = false;
+            continue;
+        }
+        m_pages[ ev ] = page;
+        if( !( (const struct perf_event_mmap_page*)page )->cap_user_rdpmc )
+            rdpmc = false;
+    }
+#if defined( __x86_64__ ) || defined( __i386__ )
+    m_rdpmc = rdpmc;
+#else
+    m_rdpmc = false;
+#endif
+}
+
+/**
+ * Cross check rdpmc with read(): each counter read with read() must lie between
+ * the rdpmc reads taken just before and just after it
+ * */
+bool PerfProfiler::verifyRdpmc() const
+{
+    uint64_t before[ NEVENT ], values[ NEVENT ], after[ NEVENT ], times[ 2 ];
+    for( int ev = 0; ev < NEVENT; ++ev )
+    {
+        before[ ev ] = m_pages[ ev ] != NULL ? readPmc( m_pages[ ev ] ) : 0;
+        values[ ev ] = 0;
+    }
+    for( int group = 0; group < PERF_NGROUP; ++group )
+        if( m_leaders[ group ] != -1 && !readGroup( group, values, times ) )
+            return false;
+    for( int ev = 0; ev < NEVENT; ++ev )
+        after[ ev ] = m_pages[ ev ] != NULL ? readPmc( m_pages[ ev ] ) : 0;
+
+    for( int ev = 0; ev < NEVENT; ++ev )
+        if( m_fds[ ev ] >= 0 && ( m_pages[ ev ] == NULL || values[ ev ] < before[ ev ] || values[ ev ] > after[ ev ] ) )
+            return false;
+    return true;
+}
+
+/**
+ * Read a group with one read()
+ *  values: counters of the group's events, in PerfEvent order
+ *  times: time enabled and time running of the group
+ * */
+bool PerfProfiler::readGroup( int group, uint64_t* values, uint64_t* times ) const
+{
+    uint64_t buf[ 3 + NEVENT ]; // nr, time enabled, time running, counters
+    int leader = m_leaders[ group ];
+    if( leader == -1 )
+        return false;
+    ssize_t n = read( leader, buf, sizeof( buf ) );
+    if( n < (ssize_t)( 3 * sizeof( uint64_t ) ) || n < (ssize_t)( ( 3 + buf[ 0 ] ) * sizeof( uint64_t ) ) )
+        return false;
+
+    for( int ev = 0; ev < NEVENT; ++ev )
+        if( EVENT_GROUPS[ ev ] == group && m_slot[ ev ] >= 0 )
+            values[ ev ] = buf[ 3 + m_slot[ ev ] ];
+    times[ 0 ] = buf[ 1 ];
+    times[ 1 ] = buf[ 2 ];
+    return true;
+}
+
+/**
+ * values: one counter per event in PerfEvent order, 0 for unavailable events
+ * */
+bool PerfProfiler::readCounters( uint64_t* values ) const
+{
+    if( m_nOpen == 0 )
+        return false;
+
+    if( m_rdpmc )
+    {
+        for( int ev = 0; ev < NEVENT; ++ev )
+            values[ ev ] = m_pages[ ev ] != NULL ? readPmc( m_pages[ ev ] ) : 0;
+        return true;
+    }
+
+    uint64_t times[ 2 ];
+    for( int ev = 0; ev < NEVENT; ++ev )
+        values[ ev ] = 0;
+    for( int group = 0; group < PERF_NGROUP; ++group )
+        if( m_leaders[ group ] != -1 && !readGroup( group, values, times ) )
+            return false;
+    return true;
+}
+
+/**
+ * Charge everything since the last switch to the current phase and start the next one
+ *  cost: one rdpmc per event and a vDSO clock_gettime; one read() per group
+ *  without rdpmc, and when starting or stopping
+ * */
+void PerfProfiler::switchTo( ProfPhase phase )
+{
+    uint64_t values[ NEVENT ];
+    bool hasValues = readCounters( values );
+    uint64_t ns = nowNs();
+
+    if( m_phase != NPHASE )
+    {
+        m_ns[ m_phase ] += ns - m_lastNs;
+        if( hasValues )
+            for( int ev = 0; ev < NEVENT; ++ev )
+                m_counts[ m_phase ][ ev ] += values[ ev ] - m_last[ ev ];
+    }
+
+    // multiplexing scale of each group over the profiled intervals
+    if( ( m_phase == NPHASE ) != ( phase == NPHASE ) )
+    {
+        uint64_t unused[ NEVENT ], times[ 2 ];
+        for( int group = 0; group < PERF_NGROUP; ++group )
+        {
+            if( !readGroup( group, unused, times ) )
+                continue;
+            if( phase != NPHASE )
+            {
+                m_startTimes[ group ][ 0 ] = times[ 0 ];
+                m_startTimes[ group ][ 1 ] = times[ 1 ];
+            }
+            else
+            {
+                m_enabled[ group ] += times[ 0 ] - m_startTimes[ group ][ 0 ];
+                m_running[ group ] += times[ 1 ] - m_startTimes[ group ][ 1 ];
+            }
+        }
+    }
+
+    m_phase = phase;
+    m_lastNs = ns;
+    if( hasValues )
+        memcpy( m_last, values, sizeof( m_last ) );
+}
+
+bool PerfProfiler::isCounted( PerfEvent ev ) const
+{
+    return hasEvent( ev ) && m_running[ EVENT_GROUPS[ ev ] ] > 0;
+}
+
+/**
+ * Per order averages of each phase, and IPC
+ * */
+void PerfProfiler::report( ostream& out, long nOrders ) const
+{
+    double perOrder = nOrders > 0 ? 1.0 / nOrders : 0;
+    double scales[ PERF_NGROUP ];
+    bool counted = false, multiplexed = false;
+    for( int group = 0; group < PERF_NGROUP; ++group )
+    {
+        scales[ group ] = m_running[ group ] > 0 ? (double)m_enabled[ group ] / m_running[ group ] : 0;
+        counted = counted || m_running[ group ] > 0;
+        multiplexed = multiplexed || m_running[ group ] < m_enabled[ group ];
+    }
+
+    out << "Profile, per order averages over " << nOrders << " orders, " << fixed << setprecision( 1 ) <<
+            m_switchNs << " ns per phase switch included";
+    out.unsetf( ios::floatfield );
+    if( hasCounters() && !counted )
+        out << ", counters never scheduled";
+    else if( counted )
+        out << ", counters read with " << ( m_rdpmc ? "rdpmc" : "read()" ) << ( multiplexed ? ", multiplexed" : "" );
+    out << endl;
+
+    out << setw( 8 ) << "phase" << setw( 12 ) << "ns";
+    for( int ev = 0; ev < NEVENT; ++ev )
+        if( isCounted( (PerfEvent)ev ) )
+            out << setw( 12 ) << EVENT_NAMES[ ev ];
+    bool ipc = isCounted( EV_CYCLES ) && isCounted( EV_INSTRUCTIONS );
+    if( ipc )
+        out << setw( 8 ) << "IPC";
+    out << endl;
+
+    out << fixed << setprecision( 2 );
+    for( int phase = 0; phase < NPHASE; ++phase )
+    {
+        out << setw( 8 ) << PHASE_NAMES[ phase ] << setw( 12 ) << m_ns[ phase ] * perOrder;
+        for( int ev = 0; ev < NEVENT; ++ev )
+            if( isCounted( (PerfEvent)ev ) )
+                out << setw( 12 ) << m_counts[ phase ][ ev ] * scales[ EVENT_GROUPS[ ev ] ] * perOrder;
+        if( ipc )
+        {
+            // same group, the scale cancels out
+            uint64_t cycles = m_counts[ phase ][ EV_CYCLES ];
+            if( cycles > 0 )
+                out << setw( 8 ) << (double)m_counts[ phase ][ EV_INSTRUCTIONS ] / cycles;
+            else
+                out << setw( 8 ) << "-";
+        }
+        out << endl;
+    }
+    out.unsetf( ios::floatfield );
+}
+
+}
@@ -0,0 +1,107 @@
+/*
+ * PerfProfiler.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef PERFPROFILER_H_
+#define PERFPROFILER_H_
+
+#include <stdint.h>
+#include <iostream>
+using namespace std;
+
+namespace Matching
+{
+
+/**
+ * Phases of MatchingEngine::run() that costs are attributed to
+ * */
+enum ProfPhase
+{
+    PHASE_PARSE,  // read and parse one input line
+    PHASE_MATCH,  // OrderBook::match
+    PHASE_ADD,    // OrderBook::add
+    PHASE_OTHER,  // stops, top of book publishing and the rest of processOrder
+    NPHASE
+};
+
+enum PerfEvent
+{
+    EV_CYCLES,
+    EV_INSTRUCTIONS,
+    EV_L1D_MISSES,
+    EV_LLC_MISSES,
+    EV_BRANCH_MISSES,
+    EV_DTLB_MISSES,
+    NEVENT
+};
+
+#define PERF_NGROUP 2 // counter groups, see PerfProfiler
+
+/**
+ * Hardware performance counter profiler based on perf_event_open
+ *  Counters are user space only, in two groups so that each fits the PMU even
+ *  with a general purpose counter held by the NMI watchdog: cycles, instructions
+ *  and branch misses (two fixed counters and one general), then L1D, LLC and
+ *  dTLB misses (three general). A group that still cannot be scheduled drops its
+ *  last events until it runs. Events the CPU or kernel do not provide are
+ *  skipped; if none can be opened (no PMU, perf_event_paranoid, seccomp) only
+ *  wall time is kept. Groups are multiplexed, each is scaled by its own
+ *  time enabled / time running at report.
+ *  At each phase switch the delta is charged to the phase that just ended.
+ *  Counters are read with rdpmc through the mmap'd perf_event_mmap_page, so a
+ *  switch makes no system call, once rdpmc has been checked against read() at
+ *  startup; where rdpmc is not allowed or disagrees, it falls back to one
+ *  read() per group. The measured cost of one switch is reported.
+ * */
+class PerfProfiler
+{
+private:
+    int m_fds[ NEVENT ]; // -1 if the event is unavailable
+    void* m_pages[ NEVENT ]; // mmap'd perf_event_mmap_page of each open event
+    int m_slot[ NEVENT ]; // position of the event in its group read
+    int m_nOpen;
+    int m_leaders[ PERF_NGROUP ]; // -1 if no event of the group is open
+    bool m_rdpmc; // every open event can be read with rdpmc, and agrees with read()
+
+    int m_phase; // current phase, NPHASE when stopped
+    uint64_t m_last[ NEVENT ]; // counters at last switch
+    uint64_t m_lastNs;
+    uint64_t m_startTimes[ PERF_NGROUP ][ 2 ]; // time enabled, time running when started
+
+    uint64_t m_counts[ NPHASE ][ NEVENT ];
+    uint64_t m_ns[ NPHASE ];
+    uint64_t m_enabled[ PERF_NGROUP ];
+    uint64_t m_running[ PERF_NGROUP ];
+    double m_switchNs; // cost of one switchTo, measured at construction
+
+    int openGroup( int group );
+    bool probeGroup( int group );
+    void mapCounters();
+    bool readGroup( int group, uint64_t* values, uint64_t* times ) const;
+    bool readCounters( uint64_t* values ) const;
+
+public:
+    PerfProfiler();
+    virtual ~PerfProfiler();
+
+    bool hasCounters() const { return m_nOpen > 0; }
+    bool hasEvent( PerfEvent ev ) const { return m_fds[ ev ] >= 0; }
+    bool isCounted( PerfEvent ev ) const;
+    bool usesRdpmc() const { return m_rdpmc; }
+    bool verifyRdpmc() const;
+
+    void switchTo( ProfPhase phase );
+    void stop() { switchTo( NPHASE ); }
+
+    uint64_t getCount( ProfPhase phase, PerfEvent ev ) const { return m_counts[ phase ][ ev ]; }
+    uint64_t getNanos( ProfPhase phase ) const { return m_ns[ phase ]; }
+
+    void report( ostream& out, long nOrders ) const;
+};
+
+}
+
+#endif /* PERFPROFILER_H_ */
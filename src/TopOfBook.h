@@ -0,0 +1,163 @@
+/*
+ * TopOfBook.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef TOPOFBOOK_H_
+#define TOPOFBOOK_H_
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace Matching
+{
+
+#define TOB_DEPTH 5
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Price level in a top of book snapshot
+ * */
+typedef struct BookLevel
+{
+    int m_price; // in cents
+    int m_quantity; // aggregate quantity of the level
+} BookLevel;
+
+/**
+ * Best TOB_DEPTH levels of each side
+ *  bids in descending price order, asks in ascending price order
+ * */
+typedef struct TopOfBookLevels
+{
+    int m_bidDepth;
+    int m_askDepth;
+    BookLevel m_bids[ TOB_DEPTH ];
+    BookLevel m_asks[ TOB_DEPTH ];
+} TopOfBookLevels;
+
+/**
+ * Seqlock protected top of book view
+ *  Single writer (the matching thread) publishes after each order that changed it, any number of
+ *  reader threads take consistent snapshots without ever writing shared memory,
+ *  so readers add no cache line contention to the writer.
+ *  The sequence is odd while a publish is in progress; a reader retries if it
+ *  observed an odd sequence or the sequence changed during its copy.
+ *  Payload words are relaxed atomics so concurrent copies are data race free.
+ *  The view is cache line aligned, its size a multiple of the line, so no other
+ *  state shares its lines. C++11 new ignores over alignment, so heap instances,
+ *  and classes holding one, allocate through alignedAllocate().
+ * */
+class TopOfBook
+{
+private:
+    alignas( CACHE_LINE_SIZE ) std::atomic< unsigned > m_seq;
+    std::atomic< int > m_bidDepth;
+    std::atomic< int > m_askDepth;
+    std::atomic< int > m_bidPrice[ TOB_DEPTH ];
+    std::atomic< int > m_bidQty[ TOB_DEPTH ];
+    std::atomic< int > m_askPrice[ TOB_DEPTH ];
+    std::atomic< int > m_askQty[ TOB_DEPTH ];
+
+public:
+    TopOfBook();
+
+    void publish( const TopOfBookLevels& levels );
+    unsigned snapshot( TopOfBookLevels& levels ) const;
+    unsigned getSequence() const { return m_seq.load( std::memory_order_acquire ); }
+
+    static void* operator new( size_t n ) { return alignedAllocate( n ); }
+    static void operator delete( void* p ) { free( p ); }
+
+    static void* alignedAllocate( size_t n );
+};
+
+/**
+ * Cache line aligned heap block, released with free()
+ * */
+inline
+void* TopOfBook::alignedAllocate( size_t n )
+{
+    void* p = NULL;
+    if( posix_memalign( &p, CACHE_LINE_SIZE, n ) != 0 )
+        throw std::bad_alloc();
+    return p;
+}
+
+inline
+TopOfBook::TopOfBook() : m_seq( 0 ), m_bidDepth( 0 ), m_askDepth( 0 )
+{
+    for( int i = 0; i < TOB_DEPTH; ++i )
+    {
+        m_bidPrice[ i ].store( 0, std::memory_order_relaxed );
+        m_bidQty[ i ].store( 0, std::memory_order_relaxed );
+        m_askPrice[ i ].store( 0, std::memory_order_relaxed );
+        m_askQty[ i ].store( 0, std::memory_order_relaxed );
+    }
+}
+
+/**
+ * Writer side, must only be called from one thread
+ *  time: O(TOB_DEPTH)
+ * */
+inline
+void TopOfBook::publish( const TopOfBookLevels& levels )
+{
+    unsigned seq = m_seq.load( std::memory_order_relaxed );
+    m_seq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    m_bidDepth.store( levels.m_bidDepth, std::memory_order_relaxed );
+    m_askDepth.store( levels.m_askDepth, std::memory_order_relaxed );
+    for( int i = 0; i < levels.m_bidDepth; ++i )
+    {
+        m_bidPrice[ i ].store( levels.m_bids[ i ].m_price, std::memory_order_relaxed );
+        m_bidQty[ i ].store( levels.m_bids[ i ].m_quantity, std::memory_order_relaxed );
+    }
+    for( int i = 0; i < levels.m_askDepth; ++i )
+    {
+        m_askPrice[ i ].store( levels.m_asks[ i ].m_price, std::memory_order_relaxed );
+        m_askQty[ i ].store( levels.m_asks[ i ].m_quantity, std::memory_order_relaxed );
+    }
+
+    m_seq.store( seq + 2, std::memory_order_release );
+}
+
+/**
+ * Reader side, safe from any number of threads
+ *  return the even sequence number the snapshot is consistent with
+ * */
+inline
+unsigned TopOfBook::snapshot( TopOfBookLevels& levels ) const
+{
+    for( ;; )
+    {
+        unsigned seq = m_seq.load( std::memory_order_acquire );
+        if( seq & 1 )
+            continue;
+
+        levels.m_bidDepth = m_bidDepth.load( std::memory_order_relaxed );
+        levels.m_askDepth = m_askDepth.load( std::memory_order_relaxed );
+        for( int i = 0; i < levels.m_bidDepth && i < TOB_DEPTH; ++i )
+        {
+            levels.m_bids[ i ].m_price = m_bidPrice[ i ].load( std::memory_order_relaxed );
+            levels.m_bids[ i ].m_quantity = m_bidQty[ i ].load( std::memory_order_relaxed );
+        }
+        for( int i = 0; i < levels.m_askDepth && i < TOB_DEPTH; ++i )
+        {
+            levels.m_asks[ i ].m_price = m_askPrice[ i ].load( std::memory_order_relaxed );
+            levels.m_asks[ i ].m_quantity = m_askQty[ i ].load( std::memory_order_relaxed );
+        }
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( m_seq.load( std::memory_order_relaxed ) == seq )
+            return seq;
+    }
+}
+
+}
+
+#endif /* TOPOFBOOK_H_ */
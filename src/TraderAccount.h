@@ -0,0 +1,87 @@
+/*
+ * TraderAccount.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lzy
+ */
+
+#ifndef TRADERACCOUNT_H_
+#define TRADERACCOUNT_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+namespace Matching
+{
+
+/**
+ * Running fill statistics of one trader, prices and money in cents
+ *  Realized P&L uses average cost: closing k of a position of |p| releases
+ *  k / |p| of its cost basis, the rounding remainder stays in the basis and is
+ *  released exactly when the position goes flat.
+ * */
+typedef struct TraderAccount
+{
+    string m_name;
+    int m_position; // net quantity, > 0 long
+    long m_fills;
+    long long m_buyQty;
+    long long m_sellQty;
+    long long m_buyNotional; // sum of price * quantity
+    long long m_sellNotional;
+    long long m_costBasis; // of the open position, < 0 for a short
+    long long m_realizedPnl;
+
+    TraderAccount( const string& name ) : m_name( name ), m_position( 0 ), m_fills( 0 ), m_buyQty( 0 ),
+            m_sellQty( 0 ), m_buyNotional( 0 ), m_sellNotional( 0 ), m_costBasis( 0 ), m_realizedPnl( 0 ) {}
+
+    void fill( int qty, int price, bool isBuy );
+
+    double getBuyVwap() const { return m_buyQty > 0 ? (double)m_buyNotional / m_buyQty : 0; }
+    double getSellVwap() const { return m_sellQty > 0 ? (double)m_sellNotional / m_sellQty : 0; }
+} TraderAccount;
+
+/**
+ * Book one fill
+ *  time: O(1), integer arithmetic only
+ * */
+inline
+void TraderAccount::fill( int qty, int price, bool isBuy )
+{
+    ++m_fills;
+    if( isBuy )
+    {
+        m_buyQty += qty;
+        m_buyNotional += (long long)qty * price;
+    }
+    else
+    {
+        m_sellQty += qty;
+        m_sellNotional += (long long)qty * price;
+    }
+
+    // reduce the open position first
+    if( m_position != 0 && ( m_position > 0 ) != isBuy )
+    {
+        int absPosition = abs( m_position );
+        int closeQty = min( qty, absPosition );
+        long long released = m_costBasis * closeQty / absPosition;
+        m_realizedPnl += ( m_position > 0 ? 1 : -1 ) * (long long)closeQty * price - released;
+        m_costBasis -= released;
+        m_position += isBuy ? closeQty : -closeQty;
+        qty -= closeQty;
+    }
+
+    // open or extend the position with the rest
+    if( qty > 0 )
+    {
+        m_costBasis += ( isBuy ? 1 : -1 ) * (long long)qty * price;
+        m_position += isBuy ? qty : -qty;
+    }
+}
+
+}
+
+#endif /* TRADERACCOUNT_H_ */
@@ -8,7 +8,16 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE TestMatch
 #include <boost/test/unit_test.hpp>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include "../src/MatchingEngine.h"
+#include "../src/BatchRunner.h"
+#include "../src/BookFork.h"
+#include "../src/OrderArchive.h"
+#include "../src/ChunkReader.h"
 #include "TestUtils.h"
 using namespace std;
 
@@ -27,6 +36,40 @@ using namespace std;
  * Deplete multiple price level
  * Deplete entire tree
  *
+ * Top of book
+ * Aggregate level quantity after add and match
+ * Republished only when an order touched the best levels
+ * Consistent snapshot under a concurrent writer
+ * Cache line aligned on the stack and the heap
+ *
+ * Order types
+ * IOC residual cancelled, FOK all or nothing, market sweeps any price
+ * Stop and stop limit triggered by prints, cascade, immediate trigger
+ *
+ * Trader accounts
+ * Notional, VWAP, fill count and average cost realized P&L through a position flip,
+ * accounts created on first fill, csv report
+ *
+ * Fork
+ * What-if match and post copy only touched levels, parent unchanged
+ * One sweep across shared, copied and depleted levels, resting stops are not triggered
+ *
+ * Arena
+ * Book memory from the arena, small and power of two classes, free list reuse, heap fallback when full
+ *
+ * Profiler
+ * Every phase of a replay is charged, with or without hardware counters, open events are scheduled, rdpmc agrees with read()
+ *
+ * Archive
+ * Round trip over several blocks with every order type, streaming and parallel decode,
+ * replay of an archive equals replay of its csv, truncated archive fails the replay
+ *
+ * Streaming input
+ * Lines straddling chunks, with and without io_uring, no trailing newline, overlong lines flagged and counted bad
+ *
+ * Batch
+ * Independent sessions over more files than threads, missing file
+ *
  * */
 BOOST_AUTO_TEST_SUITE( Matching )
 
@@ -236,6 +279,726 @@ BOOST_AUTO_TEST_CASE( TestEntireTreeMatch )
     BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n6 ), -1000 );
 }
 
+BOOST_AUTO_TEST_CASE( TestTopOfBook )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+
+    me.processOrder( new Order( 70000001, n1, 7321, 100, 100001, true ) );
+    me.processOrder( new Order( 70000002, n2, 7321, 200, 100002, true ) );
+    me.processOrder( new Order( 70000003, n1, 7311, 300, 100003, true ) );
+    me.processOrder( new Order( 70000004, n3, 7421, 400, 100004, false ) );
+    me.processOrder( new Order( 70000005, n3, 7221, 250, 100005, false ) );
+
+    TopOfBookLevels levels;
+    unsigned seq = me.getTopOfBook().snapshot( levels );
+    BOOST_CHECK_EQUAL( seq, 10u );
+    BOOST_CHECK_EQUAL( levels.m_bidDepth, 2 );
+    BOOST_CHECK_EQUAL( levels.m_bids[ 0 ].m_price, 7321 );
+    BOOST_CHECK_EQUAL( levels.m_bids[ 0 ].m_quantity, 50 );
+    BOOST_CHECK_EQUAL( levels.m_bids[ 1 ].m_price, 7311 );
+    BOOST_CHECK_EQUAL( levels.m_bids[ 1 ].m_quantity, 300 );
+    BOOST_CHECK_EQUAL( levels.m_askDepth, 1 );
+    BOOST_CHECK_EQUAL( levels.m_asks[ 0 ].m_price, 7421 );
+    BOOST_CHECK_EQUAL( levels.m_asks[ 0 ].m_quantity, 400 );
+
+    // only orders touching the best TOB_DEPTH levels republish
+    for( int i = 0; i < TOB_DEPTH - 1; ++i )
+        me.processOrder( new Order( 70000006 + i, n3, 7431 + 10 * i, 100, 100006 + i, false ) );
+    seq = me.getTopOfBook().getSequence();
+    me.processOrder( new Order( 70000010, n3, 7600, 100, 100010, false ) );
+    me.processOrder( new Order( 70000011, n1, 7000, 100, 100011, true, IOC ) );
+    BOOST_CHECK_EQUAL( me.getTopOfBook().getSequence(), seq );
+
+    me.processOrder( new Order( 70000012, n3, 7461, 100, 100012, false ) );
+    BOOST_CHECK_EQUAL( me.getTopOfBook().getSequence(), seq + 2 );
+    me.getTopOfBook().snapshot( levels );
+    BOOST_CHECK_EQUAL( levels.m_askDepth, TOB_DEPTH );
+    BOOST_CHECK_EQUAL( levels.m_asks[ TOB_DEPTH - 1 ].m_quantity, 200 );
+}
+
+BOOST_AUTO_TEST_CASE( TestTopOfBookAlignment )
+{
+    BOOST_CHECK_EQUAL( sizeof( TopOfBook ) % CACHE_LINE_SIZE, 0u );
+    MatchingEngine* me = new MatchingEngine();
+    BOOST_CHECK_EQUAL( (size_t)&me->getTopOfBook() % CACHE_LINE_SIZE, 0u );
+    delete me;
+    TopOfBook* topOfBook = new TopOfBook();
+    BOOST_CHECK_EQUAL( (size_t)topOfBook % CACHE_LINE_SIZE, 0u );
+    delete topOfBook;
+}
+
+BOOST_AUTO_TEST_CASE( TestTopOfBookConcurrentReader )
+{
+    TopOfBook topOfBook;
+    const int nPublish = 100000;
+
+    // every published snapshot has bid qty == ask qty == depth * price
+    std::thread writer( [ &topOfBook, nPublish ]()
+    {
+        TopOfBookLevels levels;
+        for( int i = 1; i <= nPublish; ++i )
+        {
+            levels.m_bidDepth = levels.m_askDepth = 1 + i % TOB_DEPTH;
+            for( int d = 0; d < levels.m_bidDepth; ++d )
+            {
+                levels.m_bids[ d ].m_price = levels.m_asks[ d ].m_price = i;
+                levels.m_bids[ d ].m_quantity = levels.m_asks[ d ].m_quantity = levels.m_bidDepth * i;
+            }
+            topOfBook.publish( levels );
+        }
+    } );
+
+    bool consistent = true;
+    TopOfBookLevels levels;
+    while( topOfBook.snapshot( levels ) < 2u * nPublish )
+    {
+        for( int d = 0; d < levels.m_bidDepth; ++d )
+        {
+            consistent &= levels.m_bidDepth == levels.m_askDepth &&
+                    levels.m_bids[ d ].m_price == levels.m_asks[ d ].m_price &&
+                    levels.m_bids[ d ].m_quantity == levels.m_bidDepth * levels.m_bids[ d ].m_price &&
+                    levels.m_asks[ d ].m_quantity == levels.m_bids[ d ].m_quantity;
+        }
+    }
+    writer.join();
+    BOOST_CHECK( consistent );
+}
+
+BOOST_AUTO_TEST_CASE( TestImmediateOrCancel )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+
+    Order* b1 = new Order( 70000001, n1, 7321, 100, 100001, true );
+    Order* b2 = new Order( 70000002, n2, 7311, 200, 100002, true );
+    me.processOrder( b1 );
+    me.processOrder( b2 );
+    me.processOrder( new Order( 70000003, n3, 7315, 300, 100003, false, IOC ) );
+
+    OrderBook* orderBook = const_cast< OrderBook* >( me.getOrderBook() );
+    BOOST_CHECK( orderBookEquals( orderBook, { b2 }, {} ) );
+
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n1 ), 100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), 0 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), -100 );
+}
+
+BOOST_AUTO_TEST_CASE( TestFillOrKill )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+
+    Order* s1 = new Order( 70000001, n1, 7321, 100, 100001, false );
+    Order* s2 = new Order( 70000002, n2, 7331, 200, 100002, false );
+    me.processOrder( s1 );
+    me.processOrder( s2 );
+
+    // not enough quantity at or below the limit, book untouched
+    me.processOrder( new Order( 70000003, n3, 7331, 301, 100003, true, FOK ) );
+    me.processOrder( new Order( 70000004, n3, 7321, 101, 100004, true, FOK ) );
+
+    OrderBook* orderBook = const_cast< OrderBook* >( me.getOrderBook() );
+    BOOST_CHECK( orderBookEquals( orderBook, {}, { s1, s2 } ) );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 0 );
+
+    me.processOrder( new Order( 70000005, n3, 7331, 250, 100005, true, FOK ) );
+    BOOST_CHECK( orderBookEquals( orderBook, {}, { s2 } ) );
+    BOOST_CHECK_EQUAL( s2->m_quantity, 50 );
+
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n1 ), -100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -150 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 250 );
+}
+
+BOOST_AUTO_TEST_CASE( TestMarketOrder )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+
+    Order* s1 = new Order( 70000001, n1, 7321, 100, 100001, false );
+    Order* s2 = new Order( 70000002, n2, 9999, 200, 100002, false );
+    me.processOrder( s1 );
+    me.processOrder( s2 );
+    me.processOrder( new Order( 70000003, n3, 0, 500, 100003, true, MARKET ) );
+
+    OrderBook* orderBook = const_cast< OrderBook* >( me.getOrderBook() );
+    BOOST_CHECK( orderBookEquals( orderBook, {}, {} ) );
+
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n1 ), -100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -200 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 300 );
+
+    // market prices are never mistaken for a missing price
+    BOOST_CHECK( IS_VALID( MKT_SELL_PRICE ) && IS_VALID( MKT_BUY_PRICE ) );
+    me.processOrder( new Order( 70000004, n1, 7000, 100, 100004, true ) );
+    me.processOrder( new Order( 70000005, n2, 0, 40, 100005, false, MARKET ) );
+    BOOST_CHECK_EQUAL( orderBook->getLastTradePrice(), 7000 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -240 );
+}
+
+BOOST_AUTO_TEST_CASE( TestStopOrderCascade )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom", n4 = "Kate", n5 = "Rob", n6 = "Bill";
+    me.init( {n1, n2, n3, n4, n5, n6 } );
+
+    me.processOrder( new Order( 70000001, n1, 7321, 100, 100001, false ) );
+    me.processOrder( new Order( 70000002, n2, 7331, 100, 100002, false ) );
+    me.processOrder( new Order( 70000003, n1, 7341, 100, 100003, false ) );
+    me.processOrder( new Order( 70000004, n3, 0, 100, 100004, true, STOP, 7331 ) );
+    Order* bill = new Order( 70000005, n6, 7341, 200, 100005, true, STOP_LIMIT, 7341 );
+    me.processOrder( bill );
+    me.processOrder( new Order( 70000006, n5, 0, 50, 100006, false, STOP, 7300 ) );
+
+    // print at 7321 triggers nothing
+    me.processOrder( new Order( 70000007, n4, 7321, 100, 100007, true ) );
+    OrderBook* orderBook = const_cast< OrderBook* >( me.getOrderBook() );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 0 );
+    BOOST_CHECK_EQUAL( orderBook->getLastTradePrice(), 7321 );
+
+    // print at 7331 triggers Tom, whose print at 7341 triggers Bill
+    me.processOrder( new Order( 70000008, n4, 7331, 50, 100008, true ) );
+    BOOST_CHECK( orderBookEquals( orderBook, { bill }, {} ) );
+    BOOST_CHECK_EQUAL( bill->m_type, LIMIT );
+    BOOST_CHECK_EQUAL( bill->m_quantity, 150 );
+
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n1 ), -200 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n4 ), 150 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n5 ), 0 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n6 ), 50 );
+
+    // last print 7341 already crossed the stop, triggers on arrival
+    me.processOrder( new Order( 70000009, n2, 0, 50, 100009, false, STOP, 7350 ) );
+    BOOST_CHECK_EQUAL( bill->m_quantity, 100 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -150 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n5 ), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( TestTraderAccounts )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Tom", n3 = "Rob";
+    me.init( { n1, n2 } );
+    const OrderBook* orderBook = me.getOrderBook();
+
+    // Mal buys 100 at 7300 in two fills
+    me.processOrder( new Order( 70000001, n2, 7300, 100, 100001, false ) );
+    me.processOrder( new Order( 70000002, n1, 7310, 60, 100002, true ) );
+    me.processOrder( new Order( 70000003, n1, 7300, 40, 100003, true ) );
+
+    // Mal sells 150 at the resting 7350 bid, closes 100 and goes short 50
+    me.processOrder( new Order( 70000004, n3, 7350, 150, 100004, true ) );
+    me.processOrder( new Order( 70000005, n1, 7350, 150, 100005, false ) );
+
+    // Mal buys back 30 at 7250 from Rob
+    me.processOrder( new Order( 70000006, n1, 7250, 30, 100006, true ) );
+    me.processOrder( new Order( 70000007, n3, 7200, 30, 100007, false ) );
+
+    const TraderAccount* mal = orderBook->getAccount( n1 );
+    BOOST_REQUIRE( mal != NULL );
+    BOOST_CHECK_EQUAL( mal->m_position, -20 );
+    BOOST_CHECK_EQUAL( mal->m_fills, 4 );
+    BOOST_CHECK_EQUAL( mal->m_buyQty, 130 );
+    BOOST_CHECK_EQUAL( mal->m_buyNotional, 947500 );
+    BOOST_CHECK_CLOSE( mal->getBuyVwap(), 947500 / 130.0, 1e-9 );
+    BOOST_CHECK_EQUAL( mal->m_sellQty, 150 );
+    BOOST_CHECK_EQUAL( mal->m_sellNotional, 1102500 );
+    BOOST_CHECK_CLOSE( mal->getSellVwap(), 7350.0, 1e-9 );
+    BOOST_CHECK_EQUAL( mal->m_realizedPnl, 5000 + 3000 );
+    BOOST_CHECK_EQUAL( mal->m_costBasis, -20 * 7350 );
+
+    const TraderAccount* tom = orderBook->getAccount( n2 );
+    BOOST_CHECK_EQUAL( tom->m_position, -100 );
+    BOOST_CHECK_EQUAL( tom->m_fills, 2 );
+    BOOST_CHECK_EQUAL( tom->m_realizedPnl, 0 );
+
+    // not registered, account created on first fill
+    const TraderAccount* rob = orderBook->getAccount( n3 );
+    BOOST_REQUIRE( rob != NULL );
+    BOOST_CHECK_EQUAL( orderBook->getAccounts()->size(), 4u ); // TRADER, Mal, Tom, Rob
+    BOOST_CHECK_EQUAL( rob->m_position, 120 );
+    BOOST_CHECK_EQUAL( rob->m_realizedPnl, -3000 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 120 );
+    BOOST_CHECK( orderBook->getAccount( "Kate" ) == NULL );
+
+    // flat again releases the whole cost basis, rounding included
+    TraderAccount account( n1 );
+    account.fill( 1, 100, true );
+    account.fill( 2, 101, true );
+    account.fill( 1, 90, false );
+    account.fill( 2, 90, false );
+    BOOST_CHECK_EQUAL( account.m_position, 0 );
+    BOOST_CHECK_EQUAL( account.m_costBasis, 0 );
+    BOOST_CHECK_EQUAL( account.m_realizedPnl, 3 * 90 - 302 );
+
+    stringstream report;
+    me.report( report );
+    string header, line;
+    getline( report, header );
+    getline( report, line );
+    BOOST_CHECK_EQUAL( line, "Kaylee,0,0,0,0,0,0,0,0,0" );
+    getline( report, line );
+    BOOST_CHECK_EQUAL( line, "Mal,-20,130,947500,7288,150,1102500,7350,4,8000" );
+}
+
+BOOST_AUTO_TEST_CASE( TestParseOrder )
+{
+    Order* order = MatchingEngine::parseOrder( "70000001,Mal,73.21,100,100001,BUY\n" );
+    BOOST_REQUIRE( order != NULL );
+    BOOST_CHECK( *order == Order( 70000001, "Mal", 7321, 100, 100001, true ) );
+    delete order;
+
+    order = MatchingEngine::parseOrder( "70000002,Tom,73.21,100,100002,SELL,FOK\r\n" );
+    BOOST_REQUIRE( order != NULL );
+    BOOST_CHECK( *order == Order( 70000002, "Tom", 7321, 100, 100002, false, FOK ) );
+    delete order;
+
+    order = MatchingEngine::parseOrder( "70000003,Tom,73.21,100,100003,SELL,STOPLIMIT,73.11\n" );
+    BOOST_REQUIRE( order != NULL );
+    BOOST_CHECK( *order == Order( 70000003, "Tom", 7321, 100, 100003, false, STOP_LIMIT, 7311 ) );
+    delete order;
+
+    BOOST_CHECK( MatchingEngine::parseOrder( "70000003,Tom,73.21,100,100003,SELL,GTD\n" ) == NULL );
+    BOOST_CHECK( MatchingEngine::parseOrder( "70000003,Tom,73.21,100,100003,SELL,STOP\n" ) == NULL );
+    BOOST_CHECK( MatchingEngine::parseOrder( "70000003,Tom,73.21,100,100003,SELL,IOC,73.11\n" ) == NULL );
+    BOOST_CHECK( MatchingEngine::parseOrder( "70000004,Tom,73.21\n" ) == NULL );
+}
+
+BOOST_AUTO_TEST_CASE( TestBookFork )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+
+    Order* b1 = new Order( 70000001, n1, 7311, 100, 100001, true );
+    Order* b2 = new Order( 70000002, n2, 7321, 200, 100002, true );
+    Order* b3 = new Order( 70000003, n1, 7301, 300, 100003, true );
+    Order* s1 = new Order( 70000004, n3, 7331, 400, 100004, false );
+    me.processOrder( b1 );
+    me.processOrder( b2 );
+    me.processOrder( b3 );
+    me.processOrder( s1 );
+
+    const OrderBook* orderBook = me.getOrderBook();
+    BookFork fork( orderBook );
+    BOOST_CHECK_EQUAL( fork.getCopiedLevels(), 0u );
+    BOOST_CHECK_EQUAL( fork.getBestBid(), 7321 );
+
+    // sweep two bid levels, post the residual at 7305
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000005, n3, 7305, 350, 100005, false ) ), 300 );
+    BOOST_REQUIRE_EQUAL( fork.getFills().size(), 2u );
+    BOOST_CHECK_EQUAL( fork.getFills()[ 0 ].m_quoteId, 70000002 );
+    BOOST_CHECK_EQUAL( fork.getFills()[ 1 ].m_price, 7311 );
+    BOOST_CHECK_EQUAL( fork.getCopiedLevels(), 3u );
+    BOOST_CHECK_EQUAL( fork.getBestBid(), 7301 );
+    BOOST_CHECK_EQUAL( fork.getBestAsk(), 7305 );
+    BOOST_CHECK_EQUAL( fork.getLevelQuantity( 7305, false ), 50 );
+    BOOST_CHECK_EQUAL( fork.getLevelQuantity( 7331, false ), 400 );
+    BOOST_CHECK_EQUAL( fork.getTraderExposure( n1 ), 100 );
+    BOOST_CHECK_EQUAL( fork.getTraderExposure( n2 ), 200 );
+    BOOST_CHECK_EQUAL( fork.getTraderExposure( n3 ), -300 );
+
+    // join the shared 7301 level, then a FOK larger than the merged levels is rejected
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000006, n2, 7301, 20, 100006, true ) ), 0 );
+    BOOST_CHECK_EQUAL( fork.getLevelQuantity( 7301, true ), 320 );
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000007, n2, 7400, 451, 100007, true, FOK ) ), 0 );
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000008, n2, 0, 60, 100008, true, MARKET ) ), 60 );
+    BOOST_CHECK_EQUAL( fork.getLevelQuantity( 7331, false ), 390 );
+
+    // parent untouched
+    BOOST_CHECK( orderBookEquals( const_cast< OrderBook* >( orderBook ), { b3, b1, b2 }, { s1 } ) );
+    BOOST_CHECK_EQUAL( b2->m_quantity, 200 );
+    BOOST_CHECK_EQUAL( orderBook->getBidMap()->at( 7301 )->getQuantity(), 300 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n1 ), 0 );
+    BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n3 ), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( TestBookForkSweep )
+{
+    MatchingEngine me;
+    string n1 = "Mal", n2 = "Kaylee", n3 = "Tom";
+    me.init( {n1, n2, n3 } );
+    for( int i = 0; i < 5; ++i )
+        me.processOrder( new Order( 70000001 + i, n1, 7301 + i, 100, 100001 + i, true ) );
+    me.processOrder( new Order( 70000006, n2, 7331, 100, 100006, false ) );
+    me.processOrder( new Order( 70000007, n2, 7341, 100, 100007, false ) );
+    me.processOrder( new Order( 70000008, n3, 0, 100, 100008, true, STOP, 7331 ) );
+
+    // one sweep walks shared, copied and depleted levels alike
+    BookFork fork( me.getOrderBook() );
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000009, n2, 7303, 50, 100009, true ) ), 0 );
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000010, n3, 7305, 100, 100010, false ) ), 100 );
+    BOOST_CHECK_EQUAL( fork.simulate( Order( 70000011, n3, 7300, 1000, 100011, false ) ), 450 );
+    BOOST_REQUIRE_EQUAL( fork.getFills().size(), 6u );
+    int prices[] = { 7305, 7304, 7303, 7303, 7302, 7301 };
+    for( size_t i = 0; i < 6; ++i )
+        BOOST_CHECK_EQUAL( fork.getFills()[ i ].m_price, prices[ i ] );
+    BOOST_CHECK_EQUAL( fork.getBestBid(), INAN );
+    BOOST_CHECK_EQUAL( fork.getBestAsk(), 7300 );
+    BOOST_CHECK_EQUAL( fork.getLevelQuantity( 7300, false ), 550 );
+    BOOST_CHECK_EQUAL( fork.getTraderExposure( n3 ), -550 );
+
+    // the resting buy stop is not triggered in the fork, it is in the engine
+    BookFork stopFork( me.getOrderBook() );
+    BOOST_CHECK_EQUAL( stopFork.simulate( Order( 70000012, n1, 7331, 100, 100012, true ) ), 100 );
+    BOOST_CHECK_EQUAL( stopFork.getBestAsk(), 7341 );
+    BOOST_CHECK_EQUAL( stopFork.getTraderExposure( n3 ), 0 );
+    BOOST_CHECK_EQUAL( stopFork.simulate( Order( 70000013, n3, 0, 100, 100013, true, STOP, 7331 ) ), 0 );
+
+    me.processOrder( new Order( 70000012, n1, 7331, 100, 100012, true ) );
+    BOOST_CHECK( me.getOrderBook()->getAskTree()->empty() );
+    BOOST_CHECK_EQUAL( me.getOrderBook()->getTraderExposure( n3 ), 100 );
+}
+
+BOOST_AUTO_TEST_CASE( TestArena )
+{
+    Arena arena( 4096, false );
+    BOOST_REQUIRE( arena.isValid() );
+
+    void* a = arena.allocate( 40 );
+    void* b = arena.allocate( 40 );
+    BOOST_CHECK( arena.owns( a ) && arena.owns( b ) );
+    BOOST_CHECK_EQUAL( arena.getUsed(), 96u );
+    arena.deallocate( a, 40 );
+    BOOST_CHECK_EQUAL( arena.allocate( 33 ), a );
+
+    // large blocks take power of two classes
+    void* c = arena.allocate( 300 );
+    BOOST_CHECK( arena.owns( c ) );
+    BOOST_CHECK_EQUAL( arena.getUsed(), 96u + 512u );
+    arena.deallocate( c, 300 );
+    BOOST_CHECK_EQUAL( arena.allocate( 512 ), c );
+    BOOST_CHECK( arena.allocate( 4096 ) == NULL );
+    BOOST_CHECK( arena.allocate( (size_t)1 << 30 ) == NULL );
+
+    while( arena.allocate( 256 ) != NULL );
+    BOOST_CHECK( arena.getUsed() <= arena.getSize() );
+    BOOST_CHECK_EQUAL( arena.prefault(), arena.getSize() );
+}
+
+BOOST_AUTO_TEST_CASE( TestArenaBackedEngine )
+{
+    Order* fromHeap = new Order( 70000001, "Mal", 7321, 100, 100001, true );
+    MatchingEngine other;
+    {
+        MatchingEngine me;
+        EngineOptions options;
+        options.m_arenaBytes = 1 << 20;
+        options.m_hugePages = true;
+        me.configure( options );
+        BOOST_REQUIRE( me.getArena() != NULL );
+        Arena* arena = me.getOrderBook()->getArena();
+        BOOST_CHECK( arena == me.getArena() );
+        BOOST_CHECK( other.getOrderBook()->getArena() == NULL );
+
+        string n1 = "Mal", n2 = "Kaylee";
+        me.init( {n1, n2 } );
+        me.processOrder( fromHeap );
+        Order* b2 = MatchingEngine::parseOrder( "70000002,Mal,73.11,200,100002,BUY\n", arena );
+        BOOST_CHECK( arena->owns( b2 ) );
+        BOOST_CHECK( !arena->owns( fromHeap ) );
+        me.processOrder( b2 );
+        me.processOrder( new Order( 70000003, n2, 7311, 250, 100003, false ) );
+
+        OrderBook* orderBook = const_cast< OrderBook* >( me.getOrderBook() );
+        BOOST_CHECK( orderBookEquals( orderBook, { b2 }, {} ) );
+        BOOST_CHECK_EQUAL( b2->m_quantity, 50 );
+        BOOST_CHECK_EQUAL( orderBook->getTraderExposure( n2 ), -250 );
+        BOOST_CHECK_EQUAL( orderBook->setArena( NULL ), -1 );
+
+        // price level bucket arrays outgrow the small classes and stay in the arena
+        size_t used = arena->getUsed();
+        orderBook->getBidMap()->rehash( 1000 );
+        BOOST_CHECK( arena->getUsed() >= used + 1000 * sizeof( void* ) );
+
+        // another book on the same thread keeps using the heap
+        used = arena->getUsed();
+        Order* elsewhere = new Order( 70000004, n1, 7311, 100, 100004, true );
+        other.processOrder( elsewhere );
+        BOOST_CHECK( !arena->owns( elsewhere ) );
+        BOOST_CHECK( !arena->owns( other.getOrderBook()->getBidMap()->begin()->second ) );
+        BOOST_CHECK_EQUAL( arena->getUsed(), used );
+    }
+    BOOST_CHECK( other.getOrderBook()->getBidTree()->size() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( TestPerfProfiler )
+{
+    string file = "test_profile.csv";
+    {
+        ofstream out( file.c_str() );
+        out << "70000001,Mal,73.21,100,100001,BUY\n70000002,Kaylee,73.11,150,100002,SELL\n";
+    }
+
+    MatchingEngine me;
+    EngineOptions options;
+    options.m_profile = true;
+    me.configure( options );
+    SessionStats stats;
+    BOOST_CHECK_EQUAL( me.replay( file, stats ), 0 );
+    remove( file.c_str() );
+
+    const PerfProfiler* profiler = me.getProfiler();
+    BOOST_REQUIRE( profiler != NULL );
+    for( int phase = 0; phase < NPHASE; ++phase )
+        BOOST_CHECK( profiler->getNanos( (ProfPhase)phase ) > 0 );
+    // an event left open after probing is scheduled
+    for( int ev = 0; ev < NEVENT; ++ev )
+        if( profiler->hasEvent( (PerfEvent)ev ) )
+            BOOST_CHECK( profiler->isCounted( (PerfEvent)ev ) );
+    if( profiler->isCounted( EV_INSTRUCTIONS ) )
+        BOOST_CHECK( profiler->getCount( PHASE_MATCH, EV_INSTRUCTIONS ) > 0 );
+    // rdpmc still agrees with read() after a replay
+    if( profiler->usesRdpmc() )
+        BOOST_CHECK( profiler->verifyRdpmc() );
+
+    ostringstream report;
+    profiler->report( report, stats.m_orders );
+    BOOST_CHECK( report.str().find( "match" ) != string::npos );
+    BOOST_CHECK( report.str().find( "per phase switch" ) != string::npos );
+    BOOST_CHECK( report.str().find( "never scheduled" ) == string::npos );
+}
+
+BOOST_AUTO_TEST_CASE( TestOrderArchive )
+{
+    vector< Order > orders;
+    string names[] = { "Mal", "Kaylee", "Tom" };
+    for( int i = 0; i < 10; ++i )
+        orders.push_back( Order( 70000001 + i * ( i % 3 ), names[ i % 3 ], 7321 - 7 * i, 100 + ( i % 4 ) * 50,
+                100001 + i, i % 2 == 0, (OrderType)( i % 6 ), i % 6 >= STOP ? 7300 + i : 0 ) );
+    orders.push_back( Order( -5, "Bill", INT32_MIN, INT32_MAX, 0, true ) );
+    orders.push_back( Order( INT32_MAX, "", INT32_MAX, 0, -1, false ) );
+
+    string file = "test_archive.mear";
+    OrderArchiveWriter writer( 4 );
+    BOOST_REQUIRE_EQUAL( writer.open( file ), 0 );
+    for( const Order& order : orders )
+        BOOST_CHECK_EQUAL( writer.append( order ), 0 );
+    BOOST_CHECK_EQUAL( writer.close(), 0 );
+    BOOST_CHECK( OrderArchiveReader::isArchive( file ) );
+
+    OrderArchiveReader reader;
+    BOOST_REQUIRE_EQUAL( reader.open( file ), 0 );
+    ArchiveBlock block;
+    size_t n = 0, nBlocks = 0;
+    while( reader.nextBlock( block ) )
+    {
+        ++nBlocks;
+        for( size_t row = 0; row < block.size(); ++row, ++n )
+        {
+            Order* order = block.newOrder( row );
+            BOOST_CHECK( n < orders.size() && *order == orders[ n ] );
+            delete order;
+        }
+    }
+    BOOST_CHECK_EQUAL( n, orders.size() );
+    BOOST_CHECK_EQUAL( nBlocks, 3u );
+
+    vector< ArchiveBlock > blocks;
+    BOOST_REQUIRE_EQUAL( OrderArchiveReader::decodeParallel( file, 2, blocks ), 0 );
+    BOOST_REQUIRE_EQUAL( blocks.size(), 3u );
+    Order* last = blocks[ 2 ].newOrder( 3 );
+    BOOST_CHECK( *last == orders.back() );
+    delete last;
+    remove( file.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( TestOrderArchiveTruncated )
+{
+    string file = "test_archive_full.mear", cut = "test_archive_cut.mear";
+    OrderArchiveWriter writer( 4 );
+    BOOST_REQUIRE_EQUAL( writer.open( file ), 0 );
+    for( int i = 0; i < 10; ++i )
+        writer.append( Order( 70000001 + i, "Mal", 7321 + i, 100, 100001 + i, i % 2 == 0 ) );
+    BOOST_REQUIRE_EQUAL( writer.close(), 0 );
+
+    string bytes;
+    {
+        ifstream in( file.c_str(), ios::binary );
+        bytes.assign( istreambuf_iterator< char >( in ), istreambuf_iterator< char >() );
+    }
+    remove( file.c_str() );
+
+    // cut mid payload, mid header, right after a block and right before the end header
+    size_t blockEnd = 2 * sizeof( uint32_t );
+    {
+        OrderArchiveReader reader;
+        ofstream( cut.c_str(), ios::binary ) << bytes;
+        BOOST_REQUIRE_EQUAL( reader.open( cut ), 0 );
+        vector< long > offsets;
+        BOOST_REQUIRE( reader.readBlockOffsets( offsets ) );
+        BOOST_REQUIRE_EQUAL( offsets.size(), 3u );
+        blockEnd = offsets[ 1 ];
+    }
+    size_t cuts[] = { blockEnd - 3, blockEnd + 5, blockEnd, bytes.size() - sizeof( ArchiveBlockHeader ) };
+    for( size_t len : cuts )
+    {
+        ofstream( cut.c_str(), ios::binary ) << bytes.substr( 0, len );
+
+        OrderArchiveReader reader;
+        BOOST_REQUIRE_EQUAL( reader.open( cut ), 0 );
+        ArchiveBlock block;
+        while( reader.nextBlock( block ) );
+        BOOST_CHECK( reader.isCorrupt() );
+        vector< ArchiveBlock > blocks;
+        BOOST_CHECK_EQUAL( OrderArchiveReader::decodeParallel( cut, 2, blocks ), -1 );
+
+        MatchingEngine me;
+        SessionStats stats;
+        BOOST_CHECK_EQUAL( me.replay( cut, stats ), -1 );
+        BOOST_CHECK_EQUAL( stats.m_status, -1 );
+        BOOST_CHECK( stats.m_orders < 10 || len == cuts[ 3 ] );
+    }
+
+    // the complete archive still reads to its end header
+    ofstream( cut.c_str(), ios::binary ) << bytes;
+    MatchingEngine me;
+    SessionStats stats;
+    BOOST_CHECK_EQUAL( me.replay( cut, stats ), 0 );
+    BOOST_CHECK_EQUAL( stats.m_orders, 10 );
+    remove( cut.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( TestOrderArchiveReplay )
+{
+    string csv = "test_archive.csv", archive = "test_archive_replay.mear";
+    {
+        ofstream out( csv.c_str() );
+        out << "70000001,Mal,73.21,100,100001,BUY\n" <<
+                "70000002,Kaylee,73.31,100,100002,SELL\n" <<
+                "70000003,Tom,0,50,100003,SELL,STOP,73.21\n" <<
+                "70000004,Kaylee,73.21,60,100004,SELL,IOC\n";
+    }
+    long nOrders = 0;
+    BOOST_REQUIRE_EQUAL( OrderArchiveWriter::convert( csv, archive, &nOrders ), 0 );
+    BOOST_CHECK_EQUAL( nOrders, 4 );
+
+    MatchingEngine fromCsv, fromArchive;
+    fromCsv.init( { "Mal", "Tom" } );
+    fromArchive.init( { "Mal", "Tom" } );
+    SessionStats csvStats, archiveStats;
+    BOOST_CHECK_EQUAL( fromCsv.replay( csv, csvStats ), 0 );
+    BOOST_CHECK_EQUAL( fromArchive.replay( archive, archiveStats ), 0 );
+    remove( csv.c_str() );
+    remove( archive.c_str() );
+
+    BOOST_CHECK_EQUAL( archiveStats.m_orders, 4 );
+    BOOST_CHECK_EQUAL( string( archiveStats.m_input ), "archive" );
+    BOOST_CHECK( string( csvStats.m_input ) == "io_uring" || string( csvStats.m_input ) == "read" );
+    BOOST_CHECK_EQUAL( archiveStats.m_exposure, csvStats.m_exposure );
+    BOOST_CHECK_EQUAL( fromArchive.getOrderBook()->getTraderExposure( "Mal" ), 100 );
+    BOOST_CHECK_EQUAL( fromArchive.getOrderBook()->getTraderExposure( "Tom" ), -40 );
+    BOOST_CHECK_EQUAL( fromCsv.getOrderBook()->getTraderExposure( "Tom" ), -40 );
+}
+
+BOOST_AUTO_TEST_CASE( TestLineReader )
+{
+    string file = "test_lines.csv";
+    vector< string > lines;
+    {
+        ofstream out( file.c_str() );
+        size_t bytes = 0;
+        for( int i = 0; bytes < 3 * CHUNK_SIZE + 100; ++i )
+        {
+            lines.push_back( to_string( 70000001 + i ) + ",Mal,73.21," + string( i % 37, '1' ) + ",BUY" );
+            bytes += lines.back().size() + 1;
+            out << lines.back() << ( bytes < 3 * CHUNK_SIZE + 100 ? "\n" : "" );
+        }
+    }
+
+    for( int async = 0; async < 2; ++async )
+    {
+        LineReader reader;
+        BOOST_REQUIRE_EQUAL( reader.open( file, async == 1 ), 0 );
+        char line[ MAX_LINE ];
+        size_t n = 0;
+        bool same = true;
+        while( reader.next( line, MAX_LINE ) )
+            same &= n < lines.size() && lines[ n++ ] == line;
+        BOOST_CHECK( same );
+        BOOST_CHECK_EQUAL( n, lines.size() );
+    }
+    remove( file.c_str() );
+
+    LineReader missing;
+    BOOST_CHECK_EQUAL( missing.open( "test_lines_missing.csv" ), -1 );
+
+    // an overlong line is flagged even though its prefix parses, then reading resumes
+    {
+        ofstream out( file.c_str() );
+        out << "70000001,Mal,73.21,100,100001,BUY\n" <<
+                "70000002,Tom,73.21,100,100002,SELL" << string( MAX_LINE, ' ' ) << ",IOC\n" <<
+                "70000003,Tom,73.21,50,100003,SELL\n";
+    }
+    {
+        LineReader reader;
+        BOOST_REQUIRE_EQUAL( reader.open( file, false ), 0 );
+        BOOST_CHECK( !reader.isAsync() );
+        char line[ MAX_LINE ];
+        BOOST_REQUIRE( reader.next( line, MAX_LINE ) );
+        BOOST_CHECK( !reader.isTruncated() );
+        BOOST_REQUIRE( reader.next( line, MAX_LINE ) );
+        BOOST_CHECK( reader.isTruncated() );
+        BOOST_CHECK_EQUAL( strlen( line ), MAX_LINE - 1u );
+        BOOST_REQUIRE( reader.next( line, MAX_LINE ) );
+        BOOST_CHECK( !reader.isTruncated() );
+        BOOST_CHECK_EQUAL( string( line ), "70000003,Tom,73.21,50,100003,SELL" );
+    }
+    MatchingEngine me;
+    SessionStats stats;
+    BOOST_CHECK_EQUAL( me.replay( file, stats ), 0 );
+    BOOST_CHECK_EQUAL( stats.m_orders, 2 );
+    BOOST_CHECK_EQUAL( stats.m_badLines, 1 );
+    remove( file.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( TestBatchRunner )
+{
+    vector< string > files;
+    for( int i = 0; i < 5; ++i )
+    {
+        files.push_back( "test_batch_" + to_string( i ) + ".csv" );
+        ofstream out( files.back().c_str() );
+        // Kaylee buys i * 10 more than she sells in session i
+        for( int j = 0; j <= i; ++j )
+            out << 70000001 + 2 * j << ",Mal,73.21," << 10 * ( j + 1 ) << "," << 100001 + 2 * j << ",SELL\n" <<
+                    70000002 + 2 * j << ",Kaylee,73.21," << 10 * j << "," << 100002 + 2 * j << ",BUY\n";
+        out << "bad line\n";
+    }
+    files.push_back( "test_batch_missing.csv" );
+
+    BatchRunner runner( 2 );
+    for( const string& file : files )
+        runner.addSession( file );
+    BOOST_CHECK_EQUAL( runner.run(), -1 );
+
+    const vector< SessionStats >& stats = runner.getStats();
+    BOOST_REQUIRE_EQUAL( stats.size(), files.size() );
+    for( int i = 0; i < 5; ++i )
+    {
+        BOOST_CHECK_EQUAL( stats[ i ].m_file, files[ i ] );
+        BOOST_CHECK_EQUAL( stats[ i ].m_status, 0 );
+        BOOST_CHECK_EQUAL( stats[ i ].m_orders, 2 * ( i + 1 ) );
+        BOOST_CHECK_EQUAL( stats[ i ].m_badLines, 1 );
+        BOOST_CHECK_EQUAL( stats[ i ].m_exposure, 10 * i * ( i + 1 ) / 2 );
+        remove( files[ i ].c_str() );
+    }
+    BOOST_CHECK_EQUAL( stats[ 5 ].m_status, -1 );
+    BOOST_CHECK( runner.getWallMs() > 0 );
+
+    stringstream summary;
+    runner.summary( summary );
+    BOOST_CHECK( summary.str().find( " orders 30 " ) != string::npos );
+    BOOST_CHECK( summary.str().find( " ordersPerSec " ) != string::npos );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 